@@ -0,0 +1,48 @@
+/*
+ * QEstEidUtil
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "CardCommand.h"
+
+QByteArray CardCommand::withData(std::initializer_list<QByteArray> data, int le) const
+{
+	int lc = 0;
+	for(const QByteArray &item: data)
+		lc += item.size();
+	QByteArray cmd;
+	cmd.reserve(6 + lc);
+	cmd.append(char(cla)).append(char(ins)).append(char(p1)).append(char(p2)).append(char(lc));
+	for(const QByteArray &item: data)
+		cmd.append(item);
+	if(le >= 0)
+		cmd.append(char(le)); // 0x100 is encoded as 00
+	return cmd;
+}
+
+QByteArray CardCommand::withLe(int le) const
+{
+	QByteArray cmd;
+	cmd.reserve(7);
+	cmd.append(char(cla)).append(char(ins)).append(char(p1)).append(char(p2));
+	if(le > 0x100)
+		cmd.append(char(0)).append(char(le >> 8)).append(char(le)); // Extended Le
+	else
+		cmd.append(char(le));
+	return cmd;
+}
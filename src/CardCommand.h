@@ -0,0 +1,50 @@
+/*
+ * QEstEidUtil
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#pragma once
+
+#include <QtCore/QByteArray>
+
+#include <initializer_list>
+
+// Short APDU header, Lc, data and Le are assembled into one buffer
+struct CardCommand
+{
+	quint8 cla, ins, p1, p2;
+
+	constexpr CardCommand withP1(quint8 value) const { return CardCommand{cla, ins, value, p2}; }
+	constexpr CardCommand withP2(quint8 value) const { return CardCommand{cla, ins, p1, value}; }
+	QByteArray withData(std::initializer_list<QByteArray> data, int le = -1) const;
+	QByteArray withLe(int le) const;
+};
+
+// EstEID commands with variable parameters or data
+namespace EstEID
+{
+constexpr CardCommand SELECTDF		{0x00, 0xA4, 0x01, 0x0C};
+constexpr CardCommand SELECTEF		{0x00, 0xA4, 0x02, 0x0C};
+constexpr CardCommand SELECTPATH	{0x00, 0xA4, 0x08, 0x0C};
+constexpr CardCommand READBINARY	{0x00, 0xB0, 0x00, 0x00};
+constexpr CardCommand READRECORD	{0x00, 0xB2, 0x00, 0x04};
+constexpr CardCommand CALCSIGN		{0x00, 0x88, 0x00, 0x00};
+constexpr CardCommand CHANGE		{0x00, 0x24, 0x00, 0x00};
+constexpr CardCommand REPLACE		{0x00, 0x2C, 0x00, 0x00};
+constexpr CardCommand VERIFY		{0x00, 0x20, 0x00, 0x00};
+}
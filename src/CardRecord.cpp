@@ -0,0 +1,62 @@
+/*
+ * QEstEidUtil
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "CardRecord.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDate>
+#include <QtCore/QString>
+
+QString CardRecord::fromCp1252(const QByteArray &data)
+{
+	// Only 0x80-0x9F differ from Latin-1, unassigned bytes map to C1 controls
+	static const ushort c1[] = {
+		0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+		0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+		0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+		0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178,
+	};
+	QString result(data.size(), Qt::Uninitialized);
+	QChar *out = result.data();
+	for(char c: data)
+	{
+		quint8 b = quint8(c);
+		*out++ = QChar(b >= 0x80 && b < 0xA0 ? c1[b - 0x80] : ushort(b));
+	}
+	return result;
+}
+
+QDate CardRecord::parseDate(const QByteArray &data)
+{
+	// Cards store dates as dd.MM.yyyy
+	static const int digits[] = {0, 1, 3, 4, 6, 7, 8, 9};
+	if(data.size() != 10 || data[2] != '.' || data[5] != '.')
+		return QDate();
+	int value[8];
+	for(int i = 0; i < 8; ++i)
+	{
+		char c = data[digits[i]];
+		if(c < '0' || c > '9')
+			return QDate();
+		value[i] = c - '0';
+	}
+	return QDate(value[4] * 1000 + value[5] * 100 + value[6] * 10 + value[7],
+		value[2] * 10 + value[3], value[0] * 10 + value[1]);
+}
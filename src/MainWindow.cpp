@@ -71,6 +71,8 @@ public:
 	QByteArray sendRequest( SSLConnect::RequestType type, const QString &param = QString() );
 	void showLoading( const QString &text );
 	void showWarning( const QString &msg, const QString &details = QString() );
+	void updateCards( const QSmartCardData &t );
+	void updateCounters( const QSmartCardData &t );
 	bool validateCardError( QSmartCardData::PinType type, int flags, QSmartCard::ErrorType err );
 	bool validatePin( QSmartCardData::PinType type, bool puk, const QString &old, const QString &pin, const QString &pin2 );
 
@@ -81,6 +83,8 @@ public:
 	QLabel *loading = nullptr;
 	QPushButton *loadPicture = nullptr, *savePicture = nullptr;
 	QButtonGroup *b = nullptr;
+	QString loadingText;
+	int pinPage = -1;
 };
 
 
@@ -149,6 +153,7 @@ void MainWindowPrivate::showLoading( const QString &text )
 	Q_Q(::MainWindow);
 	loading->setFixedSize( text.size() > 20 ? 300 : 250, 100 );
 	loading->move( q->width()/2 - loading->width()/2, 305 );
+	loadingText = text;
 	loading->setText( text );
 	loading->show();
 	loading->parentWidget()->setDisabled( true );
@@ -162,6 +167,89 @@ void MainWindowPrivate::showWarning( const QString &msg, const QString &details
 	d.exec();
 }
 
+void MainWindowPrivate::updateCards( const QSmartCardData &t )
+{
+	cards->clear();
+	cards->addItems( t.cards() );
+	cards->setVisible( t.cards().size() > 1 );
+	cards->setCurrentIndex( cards->findText( t.card() ) );
+}
+
+void MainWindowPrivate::updateCounters( const QSmartCardData &t )
+{
+	// Counters are read after personal data and certificates, nothing is blocked until they are known
+	const bool counters = t.loaded() & QSmartCardData::CountersGroup;
+	const int pin1 = counters ? t.retryCount( QSmartCardData::Pin1Type ) : THREE_ATTEMPTS;
+	const int pin2 = counters ? t.retryCount( QSmartCardData::Pin2Type ) : THREE_ATTEMPTS;
+	const int puk = counters ? t.retryCount( QSmartCardData::PukType ) : THREE_ATTEMPTS;
+
+	authInValidity->setVisible( pin1 == 0 || !t.authCert().isValid() );
+	authValidity->setVisible( pin1 > 0 && t.authCert().isValid() );
+	if ( pin1 == 0 )
+		authInValidity->setText( t.authCert().isValid() ? tr("valid but blocked") : tr("invalid and blocked") );
+	else if( !t.authCert().isValid() )
+		authInValidity->setText( tr("expired") );
+	else
+		authValidity->setText( tr("valid and applicable") );
+
+	signInValidity->setVisible( pin2 == 0 || !t.signCert().isValid() );
+	signValidity->setVisible( pin2 > 0 && t.signCert().isValid() );
+	if( pin2 == 0 )
+		signInValidity->setText( t.signCert().isValid() ? tr("valid but blocked") : tr("invalid and blocked") );
+	else if( !t.signCert().isValid() )
+		signInValidity->setText( tr("expired") );
+	else
+		signValidity->setText( tr("valid and applicable") );
+
+	authUsageCount->setText( tr( "Authentication key has been used %1 times" ).arg( t.usageCount( QSmartCardData::Pin1Type ) ) );
+	signUsageCount->setText( tr( "Signature key has been used %1 times" ).arg( t.usageCount( QSmartCardData::Pin2Type ) ) );
+	authUsageCount->setHidden( !counters || pin1 == 0 );
+	signUsageCount->setHidden( !counters || pin2 == 0 );
+
+	int authDays = std::max<int>( 0, QDateTime::currentDateTime().daysTo( t.authCert().expiryDate().toLocalTime() ) );
+	int signDays = std::max<int>( 0, QDateTime::currentDateTime().daysTo( t.signCert().expiryDate().toLocalTime() ) );
+	authCertExpired->setText( t.authCert().isValid() ?
+		tr("Certificate will expire in %1 days").arg( authDays ) : tr("Certificate is expired") );
+	signCertExpired->setText( t.signCert().isValid() ?
+		tr("Certificate will expire in %1 days").arg( signDays ) : tr("Certificate is expired") );
+	authCertExpired->setVisible( authDays <= 105 && pin1 != 0 );
+	signCertExpired->setVisible( signDays <= 105 && pin2 != 0 );
+
+	if( changePin1Info->currentWidget() == changePin1InfoPin )
+	{
+		changePin1AttemptsLable->setText( tr("Attempts left: %1").arg( pin1 ) );
+		changePin1AttemptsLable->setVisible( pin1 < THREE_ATTEMPTS );
+		changePin1PinpadAttemptsLable->setText( tr("Attempts left: %1").arg( pin1 ) );
+		changePin1PinpadAttemptsLable->setVisible( pin1 < THREE_ATTEMPTS );
+	}
+	if( changePin2Info->currentWidget() == changePin2InfoPin )
+	{
+		changePin2AttemptsLable->setText( tr("Attempts left: %1").arg( pin2 ) );
+		changePin2AttemptsLable->setVisible( pin2 < THREE_ATTEMPTS );
+		changePin2PinpadAttemptsLable->setText( tr("Attempts left: %1").arg( pin2 ) );
+		changePin2PinpadAttemptsLable->setVisible( pin2 < THREE_ATTEMPTS );
+	}
+
+	changePukAttemptsLable->setText( tr("Attempts left: %1").arg( puk ) );
+	changePukAttemptsLable->setVisible( puk < THREE_ATTEMPTS );
+	changePukPinpadAttemptsLable->setText( tr("Attempts left: %1").arg( puk ) );
+	changePukPinpadAttemptsLable->setVisible( puk < THREE_ATTEMPTS );
+
+	authChangePin->setVisible( pin1 > 0 );
+	signChangePin->setVisible( pin2 > 0 );
+	authCertBlocked->setHidden( pin1 > 0 );
+	signCertBlocked->setHidden( pin2 > 0 );
+	authRevoke->setVisible( pin1 == 0 && puk > 0 );
+	signRevoke->setVisible( pin2 == 0 && puk > 0 );
+
+	pukLocked->setVisible( puk == 0 );
+	pukChange->setVisible( puk > 0 );
+	pukLink1->setVisible( !t.isSecurePinpad() && puk > 0 );
+	pukLink2->setVisible( !t.isSecurePinpad() && puk > 0 );
+	changePin1InfoPinLink->setHidden( t.isSecurePinpad() );
+	changePin2InfoPinLink->setHidden( t.isSecurePinpad() );
+}
+
 bool MainWindowPrivate::validateCardError( QSmartCardData::PinType type, int flags, QSmartCard::ErrorType err )
 {
 	Q_Q(::MainWindow);
@@ -343,6 +431,14 @@ MainWindow::MainWindow( QWidget *parent )
 
 	d->smartcard = new QSmartCard( this );
 	connect( d->smartcard, SIGNAL(dataChanged()), SLOT(updateData()) );
+	connect( d->smartcard, SIGNAL(readerAdded(QString)), SLOT(updateCards()) );
+	connect( d->smartcard, SIGNAL(readerRemoved(QString)), SLOT(updateCards()) );
+	connect( d->smartcard, SIGNAL(cardInserted(QString,QString)), SLOT(updateCards()) );
+	connect( d->smartcard, SIGNAL(cardRemoved(QString)), SLOT(updateCards()) );
+	connect( d->smartcard, SIGNAL(countersChanged(QSmartCardData::PinType,quint8,ulong)), SLOT(updateCounters()) );
+	connect( d->smartcard, SIGNAL(pinOperationProgress(QSmartCardData::PinType,int,int)), SLOT(pinOperationProgress(QSmartCardData::PinType,int,int)) );
+	connect( d->smartcard, SIGNAL(pinOperationFinished(QSmartCardData::PinType,QSmartCard::ErrorType)),
+		SLOT(pinOperationFinished(QSmartCardData::PinType,QSmartCard::ErrorType)) );
 	d->smartcard->start();
 	connect( d->cards, SIGNAL(activated(QString)), d->smartcard, SLOT(selectCard(QString)), Qt::QueuedConnection );
 
@@ -567,9 +663,11 @@ void MainWindow::setDataPage( int index )
 		}
 #endif
 		d->showLoading( tr("Updating certificates") );
-		d->smartcard->d->m.lock();
-		Updater(d->smartcard->data().reader(), this).exec();
-		d->smartcard->d->m.unlock();
+		{
+			QSmartCard::Private::ReaderLocker locker(d->smartcard->d, t.reader());
+			d->smartcard->d->drop(t.reader()); // Updater needs exclusive connection
+			Updater(t.reader(), this).exec();
+		}
 		d->smartcard->reload();
 		break;
 	}
@@ -694,14 +792,9 @@ void MainWindow::setDataPage( int index )
 			d->showLoading( tr("Enter PIN/PUK codes on PinPad") );
 		else
 			d->showLoading( tr("Changing %1 code").arg( QSmartCardData::typeString( QSmartCardData::Pin1Type ) ) );
-		if( d->validateCardError( QSmartCardData::Pin1Type, 1024,
-				d->smartcard->change( QSmartCardData::Pin1Type, d->changePin1New->text(), d->changePin1Validate->text() ) ) )
-		{
-			QMessageBox::information( this, windowTitle(), tr("%1 changed!").arg( QSmartCardData::typeString( QSmartCardData::Pin1Type ) ) );
-			setDataPage( PageCert );
-		}
-		d->clearPins();
-		break;
+		d->pinPage = index;
+		d->smartcard->changeAsync( QSmartCardData::Pin1Type, d->changePin1New->text(), d->changePin1Validate->text() );
+		return;
 	case PagePin1ChangePuk:
 	case PagePin1ChangeUnblock:
 		if( !t.isPinpad() && !d->validatePin( QSmartCardData::Pin1Type, true,
@@ -721,28 +814,9 @@ void MainWindow::setDataPage( int index )
 		else
 			d->showLoading( tr("Enter PIN/PUK codes on PinPad") );
 
-		if( d->validateCardError( QSmartCardData::Pin1Type, 1025,
-				d->smartcard->unblock( QSmartCardData::Pin1Type, d->changePin1New->text(), d->changePin1Validate->text() ) ) )
-		{
-			if( index == PagePin1ChangePuk )
-				QMessageBox::information( this, windowTitle(), tr("%1 changed!")
-					.arg( QSmartCardData::typeString( QSmartCardData::Pin1Type ) ) );
-			else
-				QMessageBox::information( this, windowTitle(), tr("%1 has been changed and the certificate has been unblocked!")
-					.arg( QSmartCardData::typeString( QSmartCardData::Pin1Type ) ) );
-			updateData();
-			setDataPage( PageCert );
-		}
-		else
-		{
-			t = d->smartcard->data();	// refresh modified object's data
-			d->changePin1AttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::PukType ) ) );
-			d->changePin1AttemptsLable->setVisible( t.retryCount( QSmartCardData::PukType ) < THREE_ATTEMPTS );
-			d->changePin1PinpadAttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::PukType ) ) );
-			d->changePin1PinpadAttemptsLable->setVisible( t.retryCount( QSmartCardData::PukType ) < THREE_ATTEMPTS );
-		}
-		d->clearPins();
-		break;
+		d->pinPage = index;
+		d->smartcard->unblockAsync( QSmartCardData::Pin1Type, d->changePin1New->text(), d->changePin1Validate->text() );
+		return;
 	case PagePin2Pin:
 		d->changePin2Info->setCurrentWidget( d->changePin2InfoPin );
 		d->changePin2PinpadInfo->setCurrentWidget( d->changePin2PinpadInfoPin );
@@ -796,14 +870,9 @@ void MainWindow::setDataPage( int index )
 			d->showLoading( tr("Enter PIN/PUK codes on PinPad") );
 		else
 			d->showLoading( tr("Changing %1 code").arg( QSmartCardData::typeString( QSmartCardData::Pin2Type ) ) );
-		if( d->validateCardError( QSmartCardData::Pin2Type, 1024,
-				d->smartcard->change( QSmartCardData::Pin2Type, d->changePin2New->text(), d->changePin2Validate->text() ) ) )
-		{
-			QMessageBox::information( this, windowTitle(), tr("%1 changed!").arg( QSmartCardData::typeString( QSmartCardData::Pin2Type ) ) );
-			setDataPage( PageCert );
-		}
-		d->clearPins();
-		break;
+		d->pinPage = index;
+		d->smartcard->changeAsync( QSmartCardData::Pin2Type, d->changePin2New->text(), d->changePin2Validate->text() );
+		return;
 	case PagePin2ChangePuk:
 	case PagePin2ChangeUnblock:
 		if( !t.isPinpad() && !d->validatePin( QSmartCardData::Pin2Type, true,
@@ -823,8 +892,81 @@ void MainWindow::setDataPage( int index )
 		else
 			d->showLoading( tr("Enter PIN/PUK codes on PinPad") );
 
-		if( d->validateCardError( QSmartCardData::Pin2Type, 1025,
-				d->smartcard->unblock( QSmartCardData::Pin2Type, d->changePin2New->text(), d->changePin2Validate->text() ) ) )
+		d->pinPage = index;
+		d->smartcard->unblockAsync( QSmartCardData::Pin2Type, d->changePin2New->text(), d->changePin2Validate->text() );
+		return;
+	case PagePuk:
+		d->changePukValidate->setFocus();
+		d->changePukAttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::PukType ) ) );
+		d->changePukAttemptsLable->setVisible( t.retryCount( QSmartCardData::PukType ) < THREE_ATTEMPTS );
+		d->changePukPinpadAttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::PukType ) ) );
+		d->changePukPinpadAttemptsLable->setVisible( t.retryCount( QSmartCardData::PukType ) < THREE_ATTEMPTS );
+		break;
+	case PagePukChange:
+		if( !t.isPinpad() && !d->validatePin( QSmartCardData::PukType, false,
+				d->changePukValidate->text(), d->changePukNew->text(), d->changePukRepeat->text() ) )
+		{
+			d->clearPins();
+			break;
+		}
+		if( t.isPinpad() )
+			d->showLoading( tr("Enter PIN/PUK codes on PinPad") );
+		else
+			d->showLoading( tr("Changing %1 code").arg( QSmartCardData::typeString( QSmartCardData::PukType ) ) );
+		d->pinPage = index;
+		d->smartcard->changeAsync( QSmartCardData::PukType, d->changePukNew->text(), d->changePukValidate->text() );
+		return;
+	default: break;
+	}
+	d->hideLoading();
+}
+
+void MainWindow::pinOperationFinished( QSmartCardData::PinType type, QSmartCard::ErrorType error )
+{
+	const int index = d->pinPage;
+	d->pinPage = -1;
+	QSmartCardData t;
+	switch( index )
+	{
+	case PagePin1ChangePin:
+		if( d->validateCardError( type, 1024, error ) )
+		{
+			QMessageBox::information( this, windowTitle(), tr("%1 changed!").arg( QSmartCardData::typeString( QSmartCardData::Pin1Type ) ) );
+			setDataPage( PageCert );
+		}
+		break;
+	case PagePin1ChangePuk:
+	case PagePin1ChangeUnblock:
+		if( d->validateCardError( type, 1025, error ) )
+		{
+			if( index == PagePin1ChangePuk )
+				QMessageBox::information( this, windowTitle(), tr("%1 changed!")
+					.arg( QSmartCardData::typeString( QSmartCardData::Pin1Type ) ) );
+			else
+				QMessageBox::information( this, windowTitle(), tr("%1 has been changed and the certificate has been unblocked!")
+					.arg( QSmartCardData::typeString( QSmartCardData::Pin1Type ) ) );
+			updateData();
+			setDataPage( PageCert );
+		}
+		else
+		{
+			t = d->smartcard->data();	// refresh modified object's data
+			d->changePin1AttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::PukType ) ) );
+			d->changePin1AttemptsLable->setVisible( t.retryCount( QSmartCardData::PukType ) < THREE_ATTEMPTS );
+			d->changePin1PinpadAttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::PukType ) ) );
+			d->changePin1PinpadAttemptsLable->setVisible( t.retryCount( QSmartCardData::PukType ) < THREE_ATTEMPTS );
+		}
+		break;
+	case PagePin2ChangePin:
+		if( d->validateCardError( type, 1024, error ) )
+		{
+			QMessageBox::information( this, windowTitle(), tr("%1 changed!").arg( QSmartCardData::typeString( QSmartCardData::Pin2Type ) ) );
+			setDataPage( PageCert );
+		}
+		break;
+	case PagePin2ChangePuk:
+	case PagePin2ChangeUnblock:
+		if( d->validateCardError( type, 1025, error ) )
 		{
 			if( index == PagePin2ChangePuk )
 				QMessageBox::information( this, windowTitle(), tr("%1 changed!")
@@ -843,28 +985,9 @@ void MainWindow::setDataPage( int index )
 			d->changePin2PinpadAttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::PukType ) ) );
 			d->changePin2PinpadAttemptsLable->setVisible( t.retryCount( QSmartCardData::PukType ) < THREE_ATTEMPTS );
 		}
-		d->clearPins();
-		break;
-	case PagePuk:
-		d->changePukValidate->setFocus();
-		d->changePukAttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::PukType ) ) );
-		d->changePukAttemptsLable->setVisible( t.retryCount( QSmartCardData::PukType ) < THREE_ATTEMPTS );
-		d->changePukPinpadAttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::PukType ) ) );
-		d->changePukPinpadAttemptsLable->setVisible( t.retryCount( QSmartCardData::PukType ) < THREE_ATTEMPTS );
 		break;
 	case PagePukChange:
-		if( !t.isPinpad() && !d->validatePin( QSmartCardData::PukType, false,
-				d->changePukValidate->text(), d->changePukNew->text(), d->changePukRepeat->text() ) )
-		{
-			d->clearPins();
-			break;
-		}
-		if( t.isPinpad() )
-			d->showLoading( tr("Enter PIN/PUK codes on PinPad") );
-		else
-			d->showLoading( tr("Changing %1 code").arg( QSmartCardData::typeString( QSmartCardData::PukType ) ) );
-		if( d->validateCardError( QSmartCardData::PukType, 1024,
-				d->smartcard->change( QSmartCardData::PukType, d->changePukNew->text(), d->changePukValidate->text() ) ) )
+		if( d->validateCardError( type, 1024, error ) )
 		{
 			QMessageBox::information( this, windowTitle(), tr("%1 changed!").arg( QSmartCardData::typeString( QSmartCardData::PukType ) ) );
 			setDataPage( PageCert );
@@ -877,13 +1000,18 @@ void MainWindow::setDataPage( int index )
  			d->changePukPinpadAttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::PukType) ) );
  			d->changePukPinpadAttemptsLable->setVisible( t.retryCount( QSmartCardData::PukType ) < THREE_ATTEMPTS );
  		}
-		d->clearPins();
 		break;
 	default: break;
 	}
+	d->clearPins();
 	d->hideLoading();
 }
 
+void MainWindow::pinOperationProgress( QSmartCardData::PinType /*type*/, int step, int steps )
+{
+	d->loading->setText( QStringLiteral("%1 (%2/%3)").arg( d->loadingText ).arg( step ).arg( steps ) );
+}
+
 void MainWindow::showAbout()
 { (new AboutDialog( this ))->openTab( 0 ); }
 
@@ -975,66 +1103,7 @@ void MainWindow::updateData()
 		d->authTill->setText( DateTime( t.authCert().expiryDate().toLocalTime() ).formatDate( "dd. MMMM yyyy" ) );
 		d->signTill->setText( DateTime( t.signCert().expiryDate().toLocalTime() ).formatDate( "dd. MMMM yyyy" ) );
 
-		d->authInValidity->setVisible( t.retryCount( QSmartCardData::Pin1Type ) == 0 || !t.authCert().isValid() );
-		d->authValidity->setVisible( t.retryCount( QSmartCardData::Pin1Type ) > 0 && t.authCert().isValid() );
-		if ( t.retryCount( QSmartCardData::Pin1Type ) == 0 )
-			d->authInValidity->setText( t.authCert().isValid() ? tr("valid but blocked") : tr("invalid and blocked") );
-		else if( !t.authCert().isValid() )
-			d->authInValidity->setText( tr("expired") );
-		else
-			d->authValidity->setText( tr("valid and applicable") );
-
-		d->signInValidity->setVisible( t.retryCount( QSmartCardData::Pin2Type ) == 0 || !t.signCert().isValid() );
-		d->signValidity->setVisible( t.retryCount( QSmartCardData::Pin2Type ) > 0 && t.signCert().isValid() );
-		if( t.retryCount( QSmartCardData::Pin2Type ) == 0 )
-			d->signInValidity->setText( t.signCert().isValid() ? tr("valid but blocked") : tr("invalid and blocked") );
-		else if( !t.signCert().isValid() )
-			d->signInValidity->setText( tr("expired") );
-		else
-			d->signValidity->setText( tr("valid and applicable") );
-
-		d->authUsageCount->setText( tr( "Authentication key has been used %1 times" ).arg( t.usageCount( QSmartCardData::Pin1Type ) ) );
-		d->signUsageCount->setText( tr( "Signature key has been used %1 times" ).arg( t.usageCount( QSmartCardData::Pin2Type ) ) );
-		d->authUsageCount->setHidden( t.retryCount( QSmartCardData::Pin1Type ) == 0 );
-		d->signUsageCount->setHidden( t.retryCount( QSmartCardData::Pin2Type ) == 0 );
-
-		int authDays = std::max<int>( 0, QDateTime::currentDateTime().daysTo( t.authCert().expiryDate().toLocalTime() ) );
-		int signDays = std::max<int>( 0, QDateTime::currentDateTime().daysTo( t.signCert().expiryDate().toLocalTime() ) );
-		d->authCertExpired->setText( t.authCert().isValid() ?
-			tr("Certificate will expire in %1 days").arg( authDays ) : tr("Certificate is expired") );
-		d->signCertExpired->setText( t.signCert().isValid() ?
-			tr("Certificate will expire in %1 days").arg( signDays ) : tr("Certificate is expired") );
-		d->authCertExpired->setVisible( authDays <= 105 && t.retryCount( QSmartCardData::Pin1Type ) != 0 );
-		d->signCertExpired->setVisible( signDays <= 105 && t.retryCount( QSmartCardData::Pin2Type ) != 0 );
-
-		if( d->changePin1Info->currentWidget() == d->changePin1InfoPin )
-		{
-			d->changePin1AttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::Pin1Type ) ) );
-			d->changePin1AttemptsLable->setVisible( t.retryCount( QSmartCardData::Pin1Type ) < THREE_ATTEMPTS );
-			d->changePin1PinpadAttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::Pin1Type ) ) );
-			d->changePin1PinpadAttemptsLable->setVisible( t.retryCount( QSmartCardData::Pin1Type ) < THREE_ATTEMPTS );
-		}
-		if( d->changePin2Info->currentWidget() == d->changePin2InfoPin )
-		{
-			d->changePin2AttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::Pin2Type ) ) );
-			d->changePin2AttemptsLable->setVisible( t.retryCount( QSmartCardData::Pin2Type ) < THREE_ATTEMPTS );
-			d->changePin2PinpadAttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::Pin2Type ) ) );
-			d->changePin2PinpadAttemptsLable->setVisible( t.retryCount( QSmartCardData::Pin2Type ) < THREE_ATTEMPTS );
-		}
-
-		d->changePukAttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::PukType ) ) );
-		d->changePukAttemptsLable->setVisible( t.retryCount( QSmartCardData::PukType ) < THREE_ATTEMPTS );
-		d->changePukPinpadAttemptsLable->setText( tr("Attempts left: %1").arg( t.retryCount( QSmartCardData::PukType ) ) );
-		d->changePukPinpadAttemptsLable->setVisible( t.retryCount( QSmartCardData::PukType ) < THREE_ATTEMPTS );
-
-		d->authChangePin->setVisible( t.retryCount( QSmartCardData::Pin1Type ) > 0 );
-		d->signChangePin->setVisible( t.retryCount( QSmartCardData::Pin2Type ) > 0 );
-		d->authCertBlocked->setHidden( t.retryCount( QSmartCardData::Pin1Type ) > 0 );
-		d->signCertBlocked->setHidden( t.retryCount( QSmartCardData::Pin2Type ) > 0 );
-		d->authRevoke->setVisible(
-			t.retryCount( QSmartCardData::Pin1Type ) == 0 && t.retryCount( QSmartCardData::PukType ) > 0 );
-		d->signRevoke->setVisible(
-			t.retryCount( QSmartCardData::Pin2Type ) == 0 && t.retryCount( QSmartCardData::PukType ) > 0 );
+		d->updateCounters( t );
 		d->authFrame->setVisible( !t.authCert().isNull() );
 		d->signFrame->setVisible( !t.signCert().isNull() );
 		d->certsLine->setVisible( !t.authCert().isNull() || !t.signCert().isNull() );
@@ -1045,6 +1114,7 @@ void MainWindow::updateData()
 			Settings(qApp->applicationName()).value("updateButton", false).toBool() ||
 			(
 				t.version() >= QSmartCardData::VER_3_5 &&
+				t.loaded() & QSmartCardData::CountersGroup &&
 				t.retryCount( QSmartCardData::Pin1Type ) > 0 &&
 				t.isValid() &&
 				Configuration::instance().object().contains("EIDUPDATER-URL-TOECC") && (
@@ -1057,17 +1127,12 @@ void MainWindow::updateData()
 		);
 		d->certUpdate->setVisible(d->certUpdate->property("updateEnabled").toBool());
 
-		d->pukLocked->setVisible( t.retryCount( QSmartCardData::PukType ) == 0 );
-		d->pukChange->setVisible( t.retryCount( QSmartCardData::PukType ) > 0 );
-		d->pukLink1->setVisible( !t.isSecurePinpad() && t.retryCount( QSmartCardData::PukType ) > 0 );
-		d->pukLink2->setVisible( !t.isSecurePinpad() && t.retryCount( QSmartCardData::PukType ) > 0 );
-		d->changePin1InfoPinLink->setHidden( t.isSecurePinpad() );
-		d->changePin2InfoPinLink->setHidden( t.isSecurePinpad() );
-
-		if( d->dataWidget->currentIndex() == PageEmpty )
+		// Card data is published in stages, act on counters and certificates only when they are read
+		const bool certs = (t.loaded() & QSmartCardData::AuthCertGroup) && (t.loaded() & QSmartCardData::SignCertGroup);
+		if( d->dataWidget->currentIndex() == PageEmpty && t.loaded() & QSmartCardData::CountersGroup )
 			setDataPage( t.retryCount( QSmartCardData::PukType ) == 0 ? PagePukInfo : PageCert );
 
-		if(d->smartcard->property( "lastcard" ).toString() != t.card() &&
+		if( certs && d->smartcard->property( "lastcard" ).toString() != t.card() &&
 			t.version() == QSmartCardData::VER_3_4 &&
 			(!t.authCert().validateEncoding() || !t.signCert().validateEncoding()))
 		{
@@ -1082,11 +1147,12 @@ void MainWindow::updateData()
 				lbl->setOpenExternalLinks(true);
 			box.exec();
 		}
-		d->smartcard->setProperty("lastcard", t.card());
+		if( certs )
+			d->smartcard->setProperty("lastcard", t.card());
 
 #ifdef Q_OS_WIN
 		CertStore store;
-		if( !Settings().value( "Utility/showRegCert", false ).toBool() ||
+		if( !certs || !Settings().value( "Utility/showRegCert", false ).toBool() ||
 			(!store.find( t.authCert() ) || !store.find( t.signCert() )) &&
 			QMessageBox::question( this, tr( "Certificate store" ),
 				tr( "Certificate is not registered in the certificate store. Register now?" ),
@@ -1142,8 +1208,21 @@ void MainWindow::updateData()
 	d->savePicture->setHidden(d->pictureFrame->property("PICTURE").isNull() ||
 		Settings(QSettings::SystemScope).value("disableSave", false).toBool());
 
-	d->cards->clear();
-	d->cards->addItems( t.cards() );
-	d->cards->setVisible( t.cards().size() > 1 );
-	d->cards->setCurrentIndex( d->cards->findText( t.card() ) );
+	d->updateCards( t );
+}
+
+void MainWindow::updateCards()
+{
+	QSmartCardData t = d->smartcard->data();
+	if( t.isNull() )
+		updateData();
+	else
+		d->updateCards( t );
+}
+
+void MainWindow::updateCounters()
+{
+	QSmartCardData t = d->smartcard->data();
+	if( !t.isNull() )
+		d->updateCounters( t );
 }
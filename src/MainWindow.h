@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include "QSmartCard.h"
+
 #include <QtWidgets/QWidget>
 
 #define THREE_ATTEMPTS	3		// user has three attempts to enter a correct PIN1/PIN2/PUK code
@@ -75,6 +77,8 @@ public slots:
 private slots:
 	void on_languages_activated( int index );
 	void pageButtonClicked();
+	void pinOperationFinished( QSmartCardData::PinType type, QSmartCard::ErrorType error );
+	void pinOperationProgress( QSmartCardData::PinType type, int step, int steps );
 	void loadPicture();
 	void savePicture();
 	void setDataPage( int index );
@@ -83,6 +87,8 @@ private slots:
 	void showHelp();
 	void showSettings();
 	void showWarning( const QString &msg );
+	void updateCards();
+	void updateCounters();
 	void updateData();
 
 private:
@@ -0,0 +1,78 @@
+/*
+ * QEstEidUtil
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "PollRound.h"
+
+#include <algorithm>
+
+static bool cardLess(const std::pair<QString,QString> &item, const QString &card)
+{
+	return item.first < card;
+}
+
+void PollRound::reset(int count)
+{
+	readers.assign(size_t(count), Reader());
+	pending.clear();
+	cards.clear();
+}
+
+bool PollRound::collect(const QStringList &names)
+{
+	for(size_t i = 0; i < readers.size(); ++i)
+	{
+		if(!readers[i].polled)
+			return false;
+		if(readers[i].card.isEmpty())
+			continue;
+		auto pos = std::lower_bound(cards.begin(), cards.end(), readers[i].card, cardLess);
+		if(pos != cards.end() && pos->first == readers[i].card)
+			pos->second = names.at(int(i));
+		else
+			cards.insert(pos, {readers[i].card, names.at(int(i))});
+	}
+	return true;
+}
+
+bool PollRound::contains(const QString &card) const
+{
+	auto pos = std::lower_bound(cards.cbegin(), cards.cend(), card, cardLess);
+	return pos != cards.cend() && pos->first == card;
+}
+
+QString PollRound::reader(const QString &card) const
+{
+	auto pos = std::lower_bound(cards.cbegin(), cards.cend(), card, cardLess);
+	return pos != cards.cend() && pos->first == card ? pos->second : QString();
+}
+
+bool PollRound::sortCards(bool (*lessThan)(const QString &, const QString &))
+{
+	if(order.size() == int(cards.size()) && std::all_of(cards.cbegin(), cards.cend(),
+			[this](const std::pair<QString,QString> &item) { return order.contains(item.first); }))
+		return false;
+	QStringList list;
+	list.reserve(int(cards.size()));
+	for(const std::pair<QString,QString> &item: cards)
+		list << item.first;
+	std::sort(list.begin(), list.end(), lessThan);
+	order = list;
+	return true;
+}
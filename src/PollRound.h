@@ -0,0 +1,49 @@
+/*
+ * QEstEidUtil
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#pragma once
+
+#include <QtCore/QStringList>
+
+#include <utility>
+#include <vector>
+
+// Bookkeeping of one QSmartCard poll round, buffers keep their capacity between rounds
+class PollRound
+{
+public:
+	struct Reader
+	{
+		bool polled = false; // card number is known, empty when reader has no card
+		bool busy = false; // reader is used by another operation
+		QString card;
+	};
+
+	void reset(int count);
+	bool collect(const QStringList &names);
+	bool contains(const QString &card) const;
+	QString reader(const QString &card) const;
+	bool sortCards(bool (*lessThan)(const QString &, const QString &));
+
+	std::vector<Reader> readers;
+	std::vector<int> pending;
+	std::vector<std::pair<QString,QString>> cards; // card and reader, sorted by card
+	QStringList order; // shared with published data, replaced only when cards change
+};
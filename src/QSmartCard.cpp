@@ -18,19 +18,168 @@
  */
 
 #include "QSmartCard_p.h"
+#include "CardCommand.h"
+#include "CardRecord.h"
+#include "PollRound.h"
+#include "ReaderQueue.h"
+#include "TLV.h"
 
 #include <common/IKValidator.h>
 #include <common/PinDialog.h>
 #include <common/Settings.h>
 
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
 #include <QtCore/QDateTime>
 #include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
 #include <QtCore/QScopedPointer>
+#include <QtCore/QStandardPaths>
 #include <QtNetwork/QSslKey>
 #include <QtWidgets/QApplication>
 
 #include <openssl/obj_mac.h>
-#include <thread>
+
+#include <algorithm>
+
+struct AtrEntry
+{
+	quint8 size;
+	quint8 atr[33];
+	quint32 wildcard; // bit per ATR byte that is not compared
+	QSmartCardData::CardVersion version;
+};
+
+#define ATR_ANY(X) (1U << (X))
+static constexpr AtrEntry atrTable[] = {
+	{26, {0x3B,0xFE,0x94,0x00,0xFF,0x80,0xB1,0xFA,0x45,0x1F,0x03,0x45,0x73,0x74,0x45,0x49,0x44,0x20,0x76,0x65,0x72,0x20,0x31,0x2E,0x30,0x43},
+		ATR_ANY(25), QSmartCardData::VER_1_0}, /*ESTEID_V1_COLD_ATR*/
+	{18, {0x3B,0x6E,0x00,0xFF,0x45,0x73,0x74,0x45,0x49,0x44,0x20,0x76,0x65,0x72,0x20,0x31,0x2E,0x30},
+		0, QSmartCardData::VER_1_0}, /*ESTEID_V1_WARM_ATR*/
+	{26, {0x3B,0xDE,0x18,0xFF,0xC0,0x80,0xB1,0xFE,0x45,0x1F,0x03,0x45,0x73,0x74,0x45,0x49,0x44,0x20,0x76,0x65,0x72,0x20,0x31,0x2E,0x30,0x2B},
+		ATR_ANY(25), QSmartCardData::VER_1_0_2007}, /*ESTEID_V1_2007_COLD_ATR*/
+	{18, {0x3B,0x5E,0x11,0xFF,0x45,0x73,0x74,0x45,0x49,0x44,0x20,0x76,0x65,0x72,0x20,0x31,0x2E,0x30},
+		0, QSmartCardData::VER_1_0_2007}, /*ESTEID_V1_2007_WARM_ATR*/
+	{18, {0x3B,0x6E,0x00,0x00,0x45,0x73,0x74,0x45,0x49,0x44,0x20,0x76,0x65,0x72,0x20,0x31,0x2E,0x30},
+		0, QSmartCardData::VER_1_1}, /*ESTEID_V1_1_COLD_ATR*/
+	{24, {0x3B,0xFE,0x18,0x00,0x00,0x80,0x31,0xFE,0x45,0x45,0x73,0x74,0x45,0x49,0x44,0x20,0x76,0x65,0x72,0x20,0x31,0x2E,0x30,0xA8},
+		ATR_ANY(23), QSmartCardData::VER_3_4}, /*ESTEID_V3_COLD_DEV1_ATR*/
+	{24, {0x3B,0xFE,0x18,0x00,0x00,0x80,0x31,0xFE,0x45,0x80,0x31,0x80,0x66,0x40,0x90,0xA4,0x00,0x00,0x00,0x83,0x01,0x90,0x00,0x00},
+		ATR_ANY(16)|ATR_ANY(17)|ATR_ANY(18)|ATR_ANY(23), QSmartCardData::VER_3_4}, /*ESTEID_V3_WARM_DEV1_ATR, ESTEID_V3_WARM_DEV2_ATR*/
+	{24, {0x3B,0xFE,0x18,0x00,0x00,0x80,0x31,0xFE,0x45,0x80,0x31,0x80,0x66,0x40,0x90,0xA4,0x00,0x00,0x00,0x83,0x0F,0x90,0x00,0x00},
+		ATR_ANY(15)|ATR_ANY(16)|ATR_ANY(17)|ATR_ANY(18)|ATR_ANY(23), QSmartCardData::VER_3_5}, /*ESTEID_V35_WARM_ATR, UPDATER_TEST_CARDS*/
+	{20, {0x3B,0xF9,0x18,0x00,0x00,0xC0,0x0A,0x31,0xFE,0x45,0x53,0x46,0x2D,0x34,0x43,0x43,0x2D,0x30,0x31,0x81},
+		ATR_ANY(19), QSmartCardData::VER_3_5}, /*ESTEID_V35_COLD_DEV1_ATR*/
+	{18, {0x3B,0xF8,0x13,0x00,0x00,0x81,0x31,0xFE,0x45,0x4A,0x43,0x4F,0x50,0x76,0x32,0x34,0x31,0xB7},
+		ATR_ANY(17), QSmartCardData::VER_3_5}, /*ESTEID_V35_COLD_DEV2_ATR*/
+	{20, {0x3B,0xFA,0x18,0x00,0x00,0x80,0x31,0xFE,0x45,0xFE,0x65,0x49,0x44,0x20,0x2F,0x20,0x50,0x4B,0x49,0x03},
+		ATR_ANY(19), QSmartCardData::VER_3_5}, /*ESTEID_V35_COLD_DEV3_ATR*/
+};
+#undef ATR_ANY
+
+// Card read plans, steps run in order and only for requested groups
+enum PlanOp
+{
+	ReadPinRetry,
+	ReadKeyPointer,
+	ReadKeyUsage,
+	ReadAuthCert,
+	ReadSignCert,
+	ReadPersonalData,
+	ReadAppletVersion
+};
+
+struct PlanStep
+{
+	QSmartCardData::DataGroup group;
+	PlanOp op;
+	const char *path; // from MF
+	int pathSize;
+};
+
+struct ReadPlan
+{
+	QSmartCardData::CardVersion from, to;
+	const PlanStep *steps;
+	size_t count;
+};
+
+// Certificates are read before personal data, which can be taken from a matching snapshot
+static constexpr PlanStep esteidPlan[] = {
+	{QSmartCardData::CountersGroup, ReadPinRetry, "\x00\x16", 2},
+	{QSmartCardData::CountersGroup, ReadKeyPointer, "\xEE\xEE\x00\x33", 4},
+	{QSmartCardData::CountersGroup, ReadKeyUsage, "\xEE\xEE\x00\x13", 4},
+	{QSmartCardData::AuthCertGroup, ReadAuthCert, "\xEE\xEE\xAA\xCE", 4},
+	{QSmartCardData::SignCertGroup, ReadSignCert, "\xEE\xEE\xDD\xCE", 4},
+	{QSmartCardData::PersonalGroup, ReadPersonalData, "\xEE\xEE\x50\x44", 4},
+	{QSmartCardData::AppletVersionGroup, ReadAppletVersion, "", 0},
+};
+
+struct DigestInfo
+{
+	int nid;
+	char prefix[20];
+	int size;
+};
+
+// DER encoded DigestInfo header preceding the hash in PKCS#1 v1.5 signatures
+static constexpr DigestInfo digestInfo[] = {
+	{NID_sha1, "\x30\x21\x30\x09\x06\x05\x2b\x0e\x03\x02\x1a\x05\x00\x04\x14", 15},
+	{NID_sha224, "\x30\x2d\x30\x0d\x06\x09\x60\x86\x48\x01\x65\x03\x04\x02\x04\x05\x00\x04\x1c", 19},
+	{NID_sha256, "\x30\x31\x30\x0d\x06\x09\x60\x86\x48\x01\x65\x03\x04\x02\x01\x05\x00\x04\x20", 19},
+	{NID_sha384, "\x30\x41\x30\x0d\x06\x09\x60\x86\x48\x01\x65\x03\x04\x02\x02\x05\x00\x04\x30", 19},
+	{NID_sha512, "\x30\x51\x30\x0d\x06\x09\x60\x86\x48\x01\x65\x03\x04\x02\x03\x05\x00\x04\x40", 19},
+};
+
+static constexpr ReadPlan readPlans[] = {
+	{QSmartCardData::VER_1_0, QSmartCardData::VER_USABLEUPDATER, esteidPlan, sizeof(esteidPlan) / sizeof(*esteidPlan)},
+};
+
+static const AtrEntry* findAtr(const QByteArray &hex)
+{
+	const QByteArray atr = QByteArray::fromHex(hex);
+	for(const AtrEntry &entry: atrTable)
+	{
+		if(atr.size() != entry.size)
+			continue;
+		int i = 0;
+		for(; i < atr.size(); ++i)
+			if(!(entry.wildcard & (1U << i)) && quint8(atr[i]) != entry.atr[i])
+				break;
+		if(i == atr.size())
+			return &entry;
+	}
+	return nullptr;
+}
+
+static const quint8 MAX_RETRY = 3; // EstEID allows three tries for PINs and PUK
+static const quint32 SNAPSHOT_MAGIC = 0x45494443; // "EIDC"
+static const quint32 SNAPSHOT_VERSION = 2;
+// Snapshots hold personal data in plain text, keep only recently used cards
+static const int SNAPSHOT_MAX_AGE = 30; // days
+static const int SNAPSHOT_MAX_COUNT = 10;
+
+static QString snapshotDir()
+{
+	return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/cards");
+}
+
+static QString snapshotPath(const QString &card)
+{
+	return snapshotDir() + QLatin1Char('/') +
+		QString::fromLatin1(QCryptographicHash::hash(card.toUtf8(), QCryptographicHash::Sha1).toHex());
+}
+
+static void pruneSnapshots()
+{
+	const QDateTime expired = QDateTime::currentDateTimeUtc().addDays(-SNAPSHOT_MAX_AGE);
+	const QFileInfoList list = QDir(snapshotDir()).entryInfoList(QDir::Files, QDir::Time);
+	for(int i = 0; i < list.size(); ++i)
+		if(i >= SNAPSHOT_MAX_COUNT || list.at(i).lastModified().toUTC() < expired)
+			QFile::remove(list.at(i).absoluteFilePath());
+}
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 static int ECDSA_SIG_set0(ECDSA_SIG *sig, BIGNUM *r, BIGNUM *s)
@@ -56,22 +205,23 @@ QString QSmartCardData::card() const { return d->card; }
 QStringList QSmartCardData::cards() const { return d->cards; }
 
 bool QSmartCardData::isNull() const
-{ return d->data.isEmpty() && d->authCert.isNull() && d->signCert.isNull(); }
+{ return !d->loaded && !d->hasData() && d->authCert.isNull() && d->signCert.isNull(); }
+QSmartCardData::DataGroups QSmartCardData::loaded() const { return d->loaded; }
 bool QSmartCardData::isPinpad() const { return d->pinpad; }
 bool QSmartCardData::isSecurePinpad() const
 { return d->reader.contains(QLatin1String("EZIO SHIELD"), Qt::CaseInsensitive); }
 bool QSmartCardData::isValid() const
-{ return d->data.value(Expiry).toDateTime() >= QDateTime::currentDateTime(); }
+{ return d->dates[Expiry] >= QDateTime::currentDateTime(); }
 
 QString QSmartCardData::reader() const { return d->reader; }
 QStringList QSmartCardData::readers() const { return d->readers; }
 
 QVariant QSmartCardData::data(PersonalDataType type) const
-{ return d->data.value(type); }
+{ return type <= Email ? d->value(type) : QVariant(); }
 SslCertificate QSmartCardData::authCert() const { return d->authCert; }
 SslCertificate QSmartCardData::signCert() const { return d->signCert; }
-quint8 QSmartCardData::retryCount(PinType type) const { return d->retry.value(type); }
-ulong QSmartCardData::usageCount(PinType type) const { return d->usage.value(type); }
+quint8 QSmartCardData::retryCount(PinType type) const { return type <= PukType ? d->retry[type] : 0; }
+ulong QSmartCardData::usageCount(PinType type) const { return type <= PukType ? d->usage[type] : 0; }
 QString QSmartCardData::appletVersion() const { return d->appletVersion; }
 QSmartCardData::CardVersion QSmartCardData::version() const { return d->version; }
 
@@ -100,18 +250,59 @@ QString QSmartCardData::typeString(QSmartCardData::PinType type)
 
 QSharedPointer<QPCSCReader> QSmartCard::Private::connect(const QString &reader)
 {
-	qDebug() << "Connecting to reader" << reader;
-	QSharedPointer<QPCSCReader> r(new QPCSCReader(reader, &QPCSC::instance()));
-	if(!r->connect() || !r->beginTransaction())
-		r.clear();
-	return r;
+	QSharedPointer<QPCSCReader> r = pooled(reader);
+	if(r->isConnected() && !r->beginTransaction())
+	{
+		// Card was reset by other application
+		qDebug() << "Reconnecting to reader" << reader;
+		r->disconnect();
+	}
+	if(!r->isConnected())
+	{
+		qDebug() << "Connecting to reader" << reader;
+		if(!r->connect() || !r->beginTransaction())
+		{
+			drop(reader);
+			return QSharedPointer<QPCSCReader>();
+		}
+	}
+	// Other applications may have used card between transactions
+	setSelection(r.data(), Selection());
+	// Keep connection open, end only the transaction when caller is done
+	return QSharedPointer<QPCSCReader>(r.data(), [r](QPCSCReader *reader) {
+		reader->endTransaction();
+	});
+}
+
+void QSmartCard::Private::drop(const QString &reader)
+{
+	QMutexLocker locker(&poolLock);
+	pool.remove(reader);
 }
 
-QSmartCard::ErrorType QSmartCard::Private::handlePinResult(QPCSCReader *reader, const QPCSCReader::Result &response, bool forceUpdate)
+QSmartCard::ErrorType QSmartCard::Private::handlePinResult(QPCSCReader *reader, const QSmartCardData &t,
+	const QPCSCReader::Result &response, QSmartCardData::PinType type, QSmartCardData::PinType unblocked)
 {
-	if(!response || forceUpdate)
-		updateCounters(reader, t.d);
-	switch((quint8(response.SW[0]) << 8) + quint8(response.SW[1]))
+	// Status word tells remaining tries, read counters only when outcome is unknown
+	const int sw = response.SW.size() == 2 ? (quint8(response.SW[0]) << 8) + quint8(response.SW[1]) : 0;
+	QSmartCardData data = t;
+	if(sw == 0x9000)
+	{
+		data.d->retry[type] = MAX_RETRY;
+		if(unblocked)
+			data.d->retry[unblocked] = MAX_RETRY;
+		publishCounters(data, RetryCounters);
+	}
+	else if((sw & 0xFFF0) == 0x63C0 || sw == 0x6983)
+	{
+		data.d->retry[type] = sw == 0x6983 ? 0 : quint8(sw & 0x000F);
+		if(unblocked)
+			data.d->retry[unblocked] = 0;
+		publishCounters(data, RetryCounters);
+	}
+	else if(!response)
+		refreshCounters(reader, t, RetryCounters);
+	switch(sw)
 	{
 	case 0x9000: return QSmartCard::NoError;
 	case 0x63C0: return QSmartCard::BlockedError;//pin retry count 0
@@ -139,34 +330,36 @@ quint16 QSmartCard::Private::language() const
 
 QByteArray QSmartCard::Private::sign(const QByteArray &dgst, Private *d)
 {
-	if(!d ||
-		!d->reader ||
-		!d->reader->transfer(d->SECENV1) ||
-		!d->reader->transfer(APDU("002241B8 02 8300"))) //Key reference, 8303801100
+	if(!d || !d->reader)
 		return QByteArray();
-	QByteArray cmd = APDU("0088000000"); //calc signature
-	cmd[4] = char(dgst.size());
-	cmd += dgst;
-	QPCSCReader::Result result = d->reader->transfer(cmd);
+	// Environment stays set until other DF is selected or command fails
+	Selection selection = d->selection(d->reader.data());
+	if(selection.env != d->SIGNENV)
+	{
+		if(!d->transfer(d->reader.data(), d->SECENV1) ||
+			!d->transfer(d->reader.data(), d->KEYREF))
+			return QByteArray();
+		selection.env = d->SIGNENV;
+		d->setSelection(d->reader.data(), selection);
+	}
+	QPCSCReader::Result result = d->transfer(d->reader.data(), EstEID::CALCSIGN.withData({dgst}));
 	if(!result)
 		return QByteArray();
+	d->keyUsed = true;
 	return result.data;
 }
 
 int QSmartCard::Private::rsa_sign(int type, const unsigned char *m, unsigned int m_len,
 		unsigned char *sigret, unsigned int *siglen, const RSA *rsa)
 {
+	const DigestInfo *info = std::find_if(std::begin(digestInfo), std::end(digestInfo), [type](const DigestInfo &entry) {
+		return entry.nid == type;
+	});
 	QByteArray data;
-	switch(type)
-	{
-	case NID_sha1: data += QByteArray::fromHex("3021300906052b0e03021a05000414"); break;
-	case NID_sha224: data += QByteArray::fromHex("302d300d06096086480165030402040500041c"); break;
-	case NID_sha256: data += QByteArray::fromHex("3031300d060960864801650304020105000420"); break;
-	case NID_sha384: data += QByteArray::fromHex("3041300d060960864801650304020205000430"); break;
-	case NID_sha512: data += QByteArray::fromHex("3051300d060960864801650304020305000440"); break;
-	default: break;
-	}
-	data += QByteArray::fromRawData((const char*)m, int(m_len));
+	data.reserve(int(sizeof(info->prefix)) + int(m_len));
+	if(info != std::end(digestInfo))
+		data.append(info->prefix, info->size);
+	data.append((const char*)m, int(m_len));
 	QByteArray result = sign(data, (Private*)RSA_get_app_data(rsa));
 	if(result.isEmpty())
 		return 0;
@@ -195,57 +388,728 @@ ECDSA_SIG* QSmartCard::Private::ecdsa_do_sign(const unsigned char *dgst, int dgs
 	return sig;
 }
 
-bool QSmartCard::Private::updateCounters(QPCSCReader *reader, QSmartCardDataPrivate *d)
+bool QSmartCard::Private::waitForChange(const QStringList &readers, DWORD timeout)
 {
-	if(!reader->transfer(MASTER_FILE) ||
-		!reader->transfer(PINRETRY))
-		return false;
+	if(wake.fetchAndStoreOrdered(0))
+		return true;
 
-	QByteArray cmd = READRECORD;
-	for(int i = QSmartCardData::Pin1Type; i <= QSmartCardData::PukType; ++i)
+	// Reader names and state buffers are kept between rounds, rebuilt only when reader list changes
+	if(waitStale || readers != waitReaders || pnp != waitPnp)
 	{
-		cmd[2] = char(i);
-		QPCSCReader::Result data = reader->transfer(cmd);
-		if(!data)
-			return false;
-		d->retry[QSmartCardData::PinType(i)] = quint8(data.data[5]);
+		waitReaders = readers;
+		waitPnp = pnp;
+		waitStale = false;
+		waitNames.clear();
+		for(const QString &reader: readers)
+			waitNames.push_back(reader.toUtf8());
+		if(pnp)
+			waitNames.push_back(QByteArrayLiteral("\\\\?PnP?\\Notification"));
+		waitList.assign(waitNames.size(), SCARD_READERSTATE());
+		for(size_t i = 0; i < waitNames.size(); ++i)
+			waitList[i].szReader = waitNames[i].constData();
 	}
+	if(!pnp && timeout == INFINITE)
+		timeout = 5000; // Reader list changes are not signaled without PnP notification
+	for(size_t i = 0; i < waitNames.size(); ++i)
+		waitList[i].dwCurrentState = states.value(waitNames[i]).state;
 
-	if(!reader->transfer(ESTEIDDF) ||
-		!reader->transfer(KEYPOINTER))
+	switch(SCardGetStatusChange(context, timeout, waitList.data(), DWORD(waitList.size())))
+	{
+	case LONG(SCARD_S_SUCCESS):
+	{
+		QHash<QByteArray,ReaderState> next;
+		for(size_t i = 0; i < waitNames.size(); ++i)
+		{
+			ReaderState &state = next[waitNames[i]];
+			state.state = waitList[i].dwEventState & ~DWORD(SCARD_STATE_CHANGED);
+			state.atr = QByteArray((const char*)waitList[i].rgbAtr, int(waitList[i].cbAtr)).toHex().toUpper();
+		}
+		// Drop connections to readers where card was removed, inserted or replaced
+		QMutexLocker locker(&poolLock);
+		for(QHash<QString,PooledReader>::iterator i = pool.begin(); i != pool.end();)
+		{
+			const ReaderState state = next.value(i.key().toUtf8());
+			if(state.events() != i->state.events() || state.atr != i->state.atr ||
+				(state.state & SCARD_STATE_PRESENT) != (i->state.state & SCARD_STATE_PRESENT))
+				i = pool.erase(i);
+			else
+				++i;
+		}
+		states = next;
+		return true;
+	}
+	case LONG(SCARD_E_TIMEOUT):
 		return false;
+	case LONG(SCARD_E_CANCELLED):
+		wake.fetchAndStoreOrdered(0);
+		return true;
+	case LONG(SCARD_E_UNKNOWN_READER):
+		// Reader was removed meanwhile or PnP notification is not supported
+		if(pnp && readers == QPCSC::instance().readers())
+			pnp = false;
+		return true;
+	default:
+	{
+		// Service stopped or context got invalid, back off and reconnect
+		qDebug() << "Failed to wait reader state changes, reconnecting context";
+		SCardReleaseContext(context);
+		context = 0;
+		QThread::sleep(5);
+		SCardEstablishContext(SCARD_SCOPE_USER, nullptr, nullptr, &context);
+		QMutexLocker locker(&poolLock);
+		pool.clear();
+		states.clear();
+		return true;
+	}
+	}
+}
 
-	cmd[2] = 1;
-	QPCSCReader::Result data = reader->transfer(cmd);
-	if(!data)
-		return false;
+void QSmartCard::Private::wakeUp()
+{
+	wake.storeRelease(1);
+	if(context)
+		SCardCancel(context);
+}
 
-	/*
-	 * SIGN1 0100 1
-	 * SIGN2 0200 2
-	 * AUTH1 1100 3
-	 * AUTH2 1200 4
-	 */
-	quint8 signkey = data.data.at(0x13) == 0x01 && data.data.at(0x14) == 0x00 ? 1 : 2;
-	quint8 authkey = data.data.at(0x09) == 0x11 && data.data.at(0x0A) == 0x00 ? 3 : 4;
+QSharedPointer<QPCSCReader> QSmartCard::Private::pooled(const QString &reader)
+{
+	QMutexLocker locker(&poolLock);
+	PooledReader &entry = pool[reader];
+	if(!entry.reader)
+	{
+		entry.reader.reset(new QPCSCReader(reader, &QPCSC::instance()));
+		entry.state = states.value(reader.toUtf8());
+	}
+	return entry.reader;
+}
+
+bool QSmartCard::Private::readCardId(const QString &name, QString &card)
+{
+	QSharedPointer<QPCSCReader> r = pooled(name);
+	if(!r->isPresent())
+		return true;
 
-	if(!reader->transfer(KEYUSAGE))
+	const AtrEntry *entry = findAtr(r->atr());
+	if(!entry)
+	{
+		qDebug() << "Unknown ATR" << r->atr();
+		return true;
+	}
+
+	if(!r->isConnected())
+	{
+		qDebug() << "Connecting to reader" << name;
+		switch(r->connectEx())
+		{
+		case 0x8010000CL: return true; //SCARD_E_NO_SMARTCARD
+		case 0: break;
+		default: return false;
+		}
+	}
+	if(!r->beginTransaction())
+	{
+		drop(name);
 		return false;
+	}
+	setSelection(r.data(), Selection());
+	QSharedPointer<QPCSCReader> reader(r.data(), [r](QPCSCReader *reader) {
+		reader->endTransaction();
+	});
+
+	QPCSCReader::Result result = select(reader.data(), entry->version, QByteArrayLiteral("\xEE\xEE\x50\x44"));
+	#define TRANSFERIFNOT(X) result = reader->transfer(X); \
+		if(result.err) return false; \
+		if(!result)
 
-	cmd[2] = char(authkey);
-	data = reader->transfer(cmd);
-	if(!data)
+	if(result.err)
 		return false;
-	d->usage[QSmartCardData::Pin1Type] = 0xFFFFFF - ((quint8(data.data[12]) << 16) + (quint8(data.data[13]) << 8) + quint8(data.data[14]));
+	if(!result)
+	{	// Personal data file selection failed, test if it is updater applet
+		TRANSFERIFNOT(UPDATER_AID)
+			return true; // Updater applet not found
+		TRANSFERIFNOT(MASTER_FILE)
+		{	//Found updater applet but cannot select master file, select back 3.5
+			reader->transfer(AID35);
+			return true;
+		}
+		TRANSFERIFNOT(ESTEIDDF)
+			return true;
+		TRANSFERIFNOT(PERSONALDATA)
+			return true;
+		setSelection(reader.data(), Selection());
+	}
+	TRANSFERIFNOT(EstEID::READRECORD.withP1(8).withLe(0x100))
+		return true;
+	#undef TRANSFERIFNOT
+	card = CardRecord::fromCp1252(result.data);
+	return true;
+}
+
+QSmartCardData QSmartCard::Private::loadSnapshot(const QString &card) const
+{
+	QSmartCardData data;
+	if(card.isEmpty() || Settings(QSettings::SystemScope).value("disableSave", false).toBool())
+		return data;
+	QFile file(snapshotPath(card));
+	if(!file.open(QFile::ReadOnly))
+		return data;
+	if(QFileInfo(file).lastModified().toUTC() < QDateTime::currentDateTimeUtc().addDays(-SNAPSHOT_MAX_AGE))
+	{
+		file.remove();
+		return data;
+	}
+	QDataStream s(&file);
+	s.setVersion(QDataStream::Qt_5_0);
+	quint32 magic = 0, version = 0;
+	s >> magic >> version;
+	if(magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION)
+		return data;
+	QString id, appletVersion;
+	qint32 cardVersion = QSmartCardData::VER_INVALID, loaded = 0;
+	QMap<qint32,QVariant> personal;
+	QByteArray authCert, signCert;
+	QMap<qint32,quint8> retry;
+	QMap<qint32,quint64> usage;
+	s >> id >> loaded >> cardVersion >> appletVersion >> personal >> authCert >> signCert >> retry >> usage;
+	if(s.status() != QDataStream::Ok || id != card)
+		return data;
+	data.d->card = id;
+	data.d->loaded = QSmartCardData::DataGroups(loaded);
+	data.d->version = QSmartCardData::CardVersion(cardVersion);
+	data.d->appletVersion = appletVersion;
+	for(QMap<qint32,QVariant>::const_iterator i = personal.constBegin(); i != personal.constEnd(); ++i)
+	{
+		if(i.key() >= QSmartCardData::SurName && i.key() <= QSmartCardData::Email)
+			data.d->setValue(QSmartCardData::PersonalDataType(i.key()), i.value());
+	}
+	data.d->authCert = QSslCertificate(authCert, QSsl::Der);
+	data.d->signCert = QSslCertificate(signCert, QSsl::Der);
+	for(int i = QSmartCardData::Pin1Type; i <= QSmartCardData::PukType; ++i)
+	{
+		data.d->retry[i] = retry.value(i);
+		data.d->usage[i] = ulong(usage.value(i));
+	}
+	return data;
+}
+
+bool QSmartCard::Private::readCardData(QPCSCReader *reader, QSmartCardDataPrivate *t,
+	const QSmartCardDataPrivate *snapshot, QSmartCardData::DataGroups groups)
+{
+	// Applet stays selected for the rest of transaction
+	if(groups.testFlag(QSmartCardData::IdentityGroup))
+	{
+		t->reader = reader->name();
+		t->pinpad = reader->isPinPad();
+		const AtrEntry *entry = findAtr(reader->atr());
+		t->version = entry ? entry->version : QSmartCardData::VER_INVALID;
+		// Probe order decides the version of cards that carry several applets
+		if(t->version > QSmartCardData::VER_1_1)
+		{
+			if(reader->transfer(AID30).resultOk())
+				t->version = QSmartCardData::VER_3_0;
+			else if(reader->transfer(AID34).resultOk())
+				t->version = QSmartCardData::VER_3_4;
+			else if(reader->transfer(UPDATER_AID).resultOk())
+			{
+				t->version = QSmartCardData::CardVersion(t->version|QSmartCardData::VER_HASUPDATER);
+				//Prefer EstEID applet when if it is usable
+				if(!reader->transfer(AID35) ||
+					!reader->transfer(MASTER_FILE))
+				{
+					reader->transfer(UPDATER_AID);
+					t->version = QSmartCardData::VER_USABLEUPDATER;
+				}
+			}
+		}
+		// Applet selection resets current file
+		setSelection(reader, Selection());
+		t->loaded |= QSmartCardData::IdentityGroup;
+	}
+
+	// Read only requested groups that are not loaded yet
+	bool tryAgain = !runPlan(reader, t, groups & ~t->loaded, snapshot);
+
+	if(!t->loaded.testFlag(QSmartCardData::AuthCertGroup))
+		return !tryAgain;
+	t->text[QSmartCardData::Email] = t->authCert.subjectAlternativeNames().values(QSsl::EmailEntry).value(0);
+	if(t->loaded.testFlag(QSmartCardData::PersonalGroup) && t->authCert.type() & SslCertificate::DigiIDType)
+	{
+		t->text[QSmartCardData::SurName] = t->authCert.toString(QStringLiteral("SN"));
+		t->text[QSmartCardData::FirstName1] = t->authCert.toString(QStringLiteral("GN"));
+		t->text[QSmartCardData::FirstName2] = QString();
+		t->text[QSmartCardData::Id] = t->authCert.subjectInfo("serialNumber");
+		t->dates[QSmartCardData::BirthDate] = QDateTime(IKValidator::birthDate(t->authCert.subjectInfo("serialNumber")));
+		t->dates[QSmartCardData::IssueDate] = t->authCert.effectiveDate();
+		t->dates[QSmartCardData::Expiry] = t->authCert.expiryDate();
+	}
+	return !tryAgain;
+}
 
-	cmd[2] = char(signkey);
-	data = reader->transfer(cmd);
-	if(!data)
+QSmartCardData QSmartCard::Private::current() const
+{
+	// Published data is never modified, copy only takes a reference
+	return *std::atomic_load(&t);
+}
+
+void QSmartCard::Private::publish(const QSmartCardData &data)
+{
+	std::atomic_store(&t, std::make_shared<const QSmartCardData>(data));
+}
+
+QSmartCardData QSmartCard::Private::publishCard(QSmartCardData data)
+{
+	// Card and reader lists are owned by the poll thread, keep current ones
+	const QSmartCardData current = this->current();
+	data.d->cards = current.cards();
+	data.d->readers = current.readers();
+	publish(data);
+	return data;
+}
+
+QSmartCard::ErrorType QSmartCard::Private::changePin(const QSmartCardData &t, QSmartCardData::PinType type,
+	const QString &newpin, const QString &pin)
+{
+	ReaderLocker locker(this, t.reader());
+	QSharedPointer<QPCSCReader> reader(connect(t.reader()));
+	if(!reader)
+		return QSmartCard::UnknownError;
+	const CardCommand cmd = EstEID::CHANGE.withP2(type == QSmartCardData::PukType ? 0 : type);
+	QPCSCReader::Result result;
+	if(t.isPinpad())
+		result = reader->transferCTL(cmd.withData({}), false, language(), QSmartCardData::minPinLen(type));
+	else
+		result = reader->transfer(cmd.withData({pin.toUtf8(), newpin.toUtf8()}));
+	return handlePinResult(reader.data(), t, result, type);
+}
+
+bool QSmartCard::Private::Jobs::start(const QString &reader)
+{
+	QMutexLocker locker(&m);
+	if(closing)
+	{
+		if(--pending[reader] == 0)
+			pending.remove(reader);
 		return false;
-	d->usage[QSmartCardData::Pin2Type] = 0xFFFFFF - ((quint8(data.data[12]) << 16) + (quint8(data.data[13]) << 8) + quint8(data.data[14]));
+	}
+	++running;
 	return true;
 }
 
+void QSmartCard::Private::Jobs::finish(const QString &reader)
+{
+	QMutexLocker locker(&m);
+	if(--pending[reader] == 0)
+		pending.remove(reader);
+}
+
+void QSmartCard::Private::Jobs::stop()
+{
+	QMutexLocker locker(&m);
+	--running;
+	finished.wakeAll();
+}
+
+bool QSmartCard::Private::hasPendingJobs(const QString &reader)
+{
+	QMutexLocker locker(&jobs->m);
+	return jobs->pending.contains(reader);
+}
+
+bool QSmartCard::Private::isReaderBusy(const QString &reader)
+{
+	if(hasPendingJobs(reader))
+		return true;
+	QSharedPointer<QMutex> lock = readerLock(reader);
+	if(!lock->tryLock())
+		return true;
+	lock->unlock();
+	return false;
+}
+
+QSharedPointer<QMutex> QSmartCard::Private::readerLock(const QString &reader)
+{
+	QMutexLocker locker(&poolLock);
+	QSharedPointer<QMutex> &lock = locks[reader];
+	if(!lock)
+		lock.reset(new QMutex);
+	return lock;
+}
+
+void QSmartCard::Private::publishCounters(const QSmartCardData &data, int types)
+{
+	// Counters belong to the card the command was sent to, it may not be selected anymore.
+	// Only counters of given types were read, others in data may be older than published ones.
+	QSmartCardData old, next, cached;
+	{
+		QMutexLocker locker(&m);
+		old = current();
+		if(old.card() == data.card())
+		{
+			next = old;
+			next.d->copyCounters(*data.d, types & RetryCounters, types & UsageCounters);
+			publish(next);
+		}
+		if(cache.contains(data.card()))
+		{
+			cached = cache.value(data.card());
+			cached.d->copyCounters(*data.d, types & RetryCounters, types & UsageCounters);
+			cache[data.card()] = cached;
+		}
+	}
+	if(!cached.isNull())
+		saveSnapshot(cached);
+	if(old.card() != data.card())
+		return;
+	for(int i = QSmartCardData::Pin1Type; i <= QSmartCardData::PukType; ++i)
+	{
+		QSmartCardData::PinType type = QSmartCardData::PinType(i);
+		if(old.retryCount(type) != next.retryCount(type) || old.usageCount(type) != next.usageCount(type))
+			Q_EMIT q->countersChanged(type, next.retryCount(type), next.usageCount(type));
+	}
+}
+
+void QSmartCard::Private::refreshCounters(QPCSCReader *reader, const QSmartCardData &t, int types)
+{
+	QSmartCardData data = t;
+	quint32 ops = 0;
+	if(types & RetryCounters)
+		ops |= 1U << ReadPinRetry;
+	if(types & UsageCounters)
+		ops |= 1U << ReadKeyPointer | 1U << ReadKeyUsage;
+	if(runPlan(reader, data.d, QSmartCardData::CountersGroup, nullptr, ops))
+		publishCounters(data, types);
+}
+
+void QSmartCard::Private::dropSnapshot(const QString &card) const
+{
+	if(!card.isEmpty())
+		QFile::remove(snapshotPath(card));
+}
+
+void QSmartCard::Private::saveSnapshot(const QSmartCardData &data) const
+{
+	if(Settings(QSettings::SystemScope).value("disableSave", false).toBool())
+	{
+		dropSnapshot(data.card());
+		return;
+	}
+	if(data.card().isEmpty())
+		return;
+	QMap<qint32,QVariant> personal;
+	for(int i = QSmartCardData::SurName; i <= QSmartCardData::Email; ++i)
+		personal[i] = data.d->value(QSmartCardData::PersonalDataType(i));
+	QMap<qint32,quint8> retry;
+	QMap<qint32,quint64> usage;
+	for(int i = QSmartCardData::Pin1Type; i <= QSmartCardData::PukType; ++i)
+	{
+		retry[i] = data.d->retry[i];
+		usage[i] = data.d->usage[i];
+	}
+
+	// Personal data is readable only by the user, also on shared machines
+	QDir().mkpath(snapshotDir());
+	QFile::setPermissions(snapshotDir(), QFile::ReadOwner|QFile::WriteOwner|QFile::ExeOwner);
+	QSaveFile file(snapshotPath(data.card()));
+	if(!file.open(QFile::WriteOnly))
+		return;
+	file.setPermissions(QFile::ReadOwner|QFile::WriteOwner);
+	QDataStream s(&file);
+	s.setVersion(QDataStream::Qt_5_0);
+	s << SNAPSHOT_MAGIC << SNAPSHOT_VERSION << data.card() << qint32(data.loaded()) << qint32(data.version()) << data.appletVersion()
+		<< personal << data.authCert().toDer() << data.signCert().toDer() << retry << usage;
+	if(file.commit())
+		pruneSnapshots();
+}
+
+QPCSCReader::Result QSmartCard::Private::select(QPCSCReader *reader, QSmartCardData::CardVersion version, const QByteArray &path, bool fci)
+{
+	const Selection current = selection(reader);
+	QPCSCReader::Result result;
+	if(!fci && current.valid && current.file == path)
+	{
+		result.SW = QByteArrayLiteral("\x90\x00");
+		return result;
+	}
+
+	auto withFCI = [&](const CardCommand &cmd, const QByteArray &data) {
+		if(!fci)
+			return cmd.withData({data});
+		return cmd.withP2(0x00).withData({data}, reader->protocol() == QPCSCReader::T1 ? 0x100 : -1);
+	};
+	const QByteArray df = path.left(path.size() - 2);
+	const bool sameDF = current.valid && current.file.left(current.file.size() - 2) == df;
+	if(sameDF)
+		result = reader->transfer(withFCI(EstEID::SELECTEF, path.right(2)));
+	else
+	{
+		// EstEID 3.x applets select path from MF in one command
+		version = QSmartCardData::CardVersion(version & ~QSmartCardData::VER_HASUPDATER);
+		bool byPath = version >= QSmartCardData::VER_3_0 && version <= QSmartCardData::VER_3_5;
+		if(byPath)
+		{
+			QMutexLocker locker(&poolLock);
+			byPath = !noPathSelect.contains(reader->atr());
+		}
+		if(byPath)
+		{
+			result = reader->transfer(withFCI(EstEID::SELECTPATH, path));
+			if(!result && !result.err && (quint8(result.SW[0]) << 8) + quint8(result.SW[1]) != 0x6A82) //File not found
+			{
+				qDebug() << "SELECT by path not supported, using DF chain" << result.SW.toHex();
+				QMutexLocker locker(&poolLock);
+				noPathSelect << reader->atr();
+				byPath = false;
+			}
+		}
+		if(!byPath)
+		{
+			result = reader->transfer(MASTER_FILE);
+			for(int i = 0; result && i < path.size(); i += 2)
+				result = reader->transfer(i + 2 < path.size() ? EstEID::SELECTDF.withData({path.mid(i, 2)}) : withFCI(EstEID::SELECTEF, path.mid(i, 2)));
+		}
+	}
+
+	Selection next;
+	if(result)
+	{
+		next.valid = true;
+		next.file = path;
+		if(sameDF)
+			next.env = current.env;
+	}
+	setSelection(reader, next);
+	return result;
+}
+
+QSmartCard::Private::Selection QSmartCard::Private::selection(QPCSCReader *reader)
+{
+	QMutexLocker locker(&poolLock);
+	const PooledReader entry = pool.value(reader->name());
+	return entry.reader.data() == reader ? entry.selection : Selection();
+}
+
+void QSmartCard::Private::setSelection(QPCSCReader *reader, const Selection &selection)
+{
+	QMutexLocker locker(&poolLock);
+	QHash<QString,PooledReader>::iterator i = pool.find(reader->name());
+	if(i != pool.end() && i->reader.data() == reader)
+		i->selection = selection;
+}
+
+QPCSCReader::Result QSmartCard::Private::transfer(QPCSCReader *reader, const QByteArray &cmd)
+{
+	QPCSCReader::Result result = reader->transfer(cmd);
+	if(!result)
+		setSelection(reader, Selection());
+	return result;
+}
+
+QSmartCard::ErrorType QSmartCard::Private::unblockPin(const QSmartCardData &t, QSmartCardData::PinType type,
+	const QString &pin, const QString &puk)
+{
+	ReaderLocker locker(this, t.reader());
+	QSharedPointer<QPCSCReader> reader(connect(t.reader()));
+	if(!reader)
+		return QSmartCard::UnknownError;
+
+	const int steps = (t.isPinpad() ? 0 : 1) + MAX_RETRY + 2;
+	int step = 0;
+	QPCSCReader::Result result;
+
+	if(!t.isPinpad())
+	{
+		//Verify PUK. Not for pinpad.
+		Q_EMIT q->pinOperationProgress(type, ++step, steps);
+		result = reader->transfer(EstEID::VERIFY.withP2(0).withData({puk.toUtf8()}));
+		if(!result)
+			return handlePinResult(reader.data(), t, result, QSmartCardData::PukType);
+	}
+
+	// Make sure pin is locked. ID card is designed so that only blocked PIN could be unblocked with PUK!
+	// Known retry count may be stale or not read yet, the card tells when the PIN is blocked.
+	const QByteArray wrong(pin.size(), '0');
+	for(quint8 i = 0; i <= MAX_RETRY; ++i)
+	{
+		Q_EMIT q->pinOperationProgress(type, ++step, steps);
+		const QPCSCReader::Result verify = reader->transfer(EstEID::VERIFY.withP2(type).withData({wrong, QByteArray::number(i)}));
+		const int sw = verify.SW.size() == 2 ? (quint8(verify.SW[0]) << 8) + quint8(verify.SW[1]) : 0;
+		if(sw == 0x63C0 || sw == 0x6983 || verify.err)
+			break;
+	}
+
+	//Replace PIN with PUK
+	step = steps - 1;
+	Q_EMIT q->pinOperationProgress(type, ++step, steps);
+	const CardCommand cmd = EstEID::REPLACE.withP2(type);
+	if(t.isPinpad())
+		result = reader->transferCTL(cmd.withData({}), false, language(), QSmartCardData::minPinLen(type));
+	else
+		result = reader->transfer(cmd.withData({puk.toUtf8(), pin.toUtf8()}));
+	return handlePinResult(reader.data(), t, result, QSmartCardData::PukType, type);
+}
+
+bool QSmartCard::Private::runPlan(QPCSCReader *reader, QSmartCardDataPrivate *t,
+	QSmartCardData::DataGroups groups, const QSmartCardDataPrivate *snapshot, quint32 ops)
+{
+	const QSmartCardData::CardVersion version = QSmartCardData::CardVersion(t->version & ~QSmartCardData::VER_HASUPDATER);
+	const ReadPlan *plan = std::find_if(std::begin(readPlans), std::end(readPlans), [&](const ReadPlan &entry) {
+		return version >= entry.from && version <= entry.to;
+	});
+	if(plan == std::end(readPlans))
+		return false;
+
+	auto readRecord = [&](quint8 record) {
+		return transfer(reader, EstEID::READRECORD.withP1(record).withLe(0x100));
+	};
+	// Personal data and applet version do not change without reissuing certificates
+	auto fromSnapshot = [&](QSmartCardData::DataGroup group) {
+		if(!snapshot || snapshot->authCert.isNull() || !snapshot->loaded.testFlag(group) ||
+			t->authCert != snapshot->authCert || t->signCert != snapshot->signCert)
+			return false;
+		if(group == QSmartCardData::PersonalGroup)
+			t->copyData(*snapshot);
+		else if(group == QSmartCardData::AppletVersionGroup)
+			t->appletVersion = snapshot->appletVersion;
+		else
+			return false;
+		return true;
+	};
+
+	QSmartCardData::DataGroups failed, restored;
+	quint8 authKey = 3, signKey = 1;
+	for(const PlanStep *step = plan->steps; step != plan->steps + plan->count; ++step)
+	{
+		if(!groups.testFlag(step->group) || !(ops & (1U << step->op)) ||
+			failed.testFlag(step->group) || restored.testFlag(step->group))
+			continue;
+		if(fromSnapshot(step->group))
+		{
+			restored |= step->group;
+			continue;
+		}
+		const QByteArray path = QByteArray::fromRawData(step->path, step->pathSize);
+		bool ok = true;
+		switch(step->op)
+		{
+		case ReadPinRetry:
+			ok = bool(select(reader, t->version, path));
+			for(int i = QSmartCardData::Pin1Type; ok && i <= QSmartCardData::PukType; ++i)
+			{
+				QPCSCReader::Result data = readRecord(quint8(i));
+				if((ok = bool(data)))
+					t->retry[QSmartCardData::PinType(i)] = quint8(data.data[5]);
+			}
+			break;
+		case ReadKeyPointer:
+		{
+			QPCSCReader::Result data;
+			ok = select(reader, t->version, path) && (data = readRecord(1));
+			if(!ok)
+				break;
+			/*
+			 * SIGN1 0100 1
+			 * SIGN2 0200 2
+			 * AUTH1 1100 3
+			 * AUTH2 1200 4
+			 */
+			signKey = data.data.at(0x13) == 0x01 && data.data.at(0x14) == 0x00 ? 1 : 2;
+			authKey = data.data.at(0x09) == 0x11 && data.data.at(0x0A) == 0x00 ? 3 : 4;
+			break;
+		}
+		case ReadKeyUsage:
+			ok = bool(select(reader, t->version, path));
+			for(const std::pair<QSmartCardData::PinType,quint8> &key: {
+				std::make_pair(QSmartCardData::Pin1Type, authKey), std::make_pair(QSmartCardData::Pin2Type, signKey)})
+			{
+				QPCSCReader::Result data;
+				if(!ok || !(ok = bool(data = readRecord(key.second))))
+					break;
+				t->usage[key.first] = 0xFFFFFF - ((quint8(data.data[12]) << 16) + (quint8(data.data[13]) << 8) + quint8(data.data[14]));
+			}
+			break;
+		case ReadAuthCert:
+		case ReadSignCert:
+		{
+			SslCertificate &cert = step->op == ReadAuthCert ? t->authCert : t->signCert;
+			QSslCertificate cached;
+			if(snapshot)
+				cached = step->op == ReadAuthCert ? snapshot->authCert : snapshot->signCert;
+			QPCSCReader::Result data = select(reader, t->version, path, true);
+			if(!data)
+			{
+				cert = QSslCertificate();
+				break;
+			}
+			const QByteArray der = cached.toDer();
+			QByteArray result = QSmartCard::readCert(reader, data.data, der);
+			if((ok = !result.isEmpty()))
+				cert = !der.isEmpty() && result == der ? cached : QSslCertificate(result, QSsl::Der);
+			else
+				setSelection(reader, Selection());
+			break;
+		}
+		case ReadPersonalData:
+		{
+			if(!select(reader, t->version, path).resultOk())
+				break;
+			// Send record reads back to back, decode when card is done
+			QByteArray records[QSmartCardData::Comment4];
+			int count = QSmartCardData::SurName;
+			for(; count != QSmartCardData::Comment4; ++count)
+			{
+				// Document number is already read for card identification
+				if(count == QSmartCardData::DocumentId && !t->card.isEmpty())
+					continue;
+				QPCSCReader::Result result = readRecord(quint8(count + 1));
+				if(!(ok = bool(result)))
+					break;
+				records[count] = result.data;
+			}
+
+			for(int data = QSmartCardData::SurName; data != count; ++data)
+			{
+				const QByteArray record = records[data].trimmed();
+				switch(data)
+				{
+				case QSmartCardData::BirthDate:
+				case QSmartCardData::Expiry:
+				case QSmartCardData::IssueDate:
+					t->dates[data] = QDateTime(CardRecord::parseDate(record));
+					break;
+				default:
+					if(data == QSmartCardData::DocumentId && !t->card.isEmpty())
+						t->text[data] = t->card.trimmed();
+					else
+						t->text[data] = record == QByteArray(1, 0) ? QString() : CardRecord::fromCp1252(record);
+					break;
+				}
+			}
+			break;
+		}
+		case ReadAppletVersion:
+		{
+			QPCSCReader::Result data = transfer(reader, APPLETVER);
+			if (data.resultOk())
+			{
+				for(int i = 0; i < data.data.size(); ++i)
+				{
+					if(i == 0)
+						t->appletVersion = QString::number(quint8(data.data[i]));
+					else
+						t->appletVersion += QString(QStringLiteral(".%1")).arg(quint8(data.data[i]));
+				}
+			}
+			break;
+		}
+		}
+		if(!ok)
+			failed |= step->group;
+	}
+	if(ops == ~0U)
+		t->loaded |= groups & ~failed;
+	return !failed;
+}
+
 
 
 
@@ -253,6 +1117,11 @@ QSmartCard::QSmartCard(QObject *parent)
 :	QThread(parent)
 ,	d(new Private)
 {
+	qRegisterMetaType<QSmartCardData>("QSmartCardData");
+	qRegisterMetaType<QSmartCardData::PinType>("QSmartCardData::PinType");
+	qRegisterMetaType<QSmartCard::ErrorType>("QSmartCard::ErrorType");
+	qRegisterMetaType<QSslCertificate>("QSslCertificate");
+	d->q = this;
 #if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
 	d->rsamethod.name = "QSmartCard";
 	d->rsamethod.rsa_sign = Private::rsa_sign;
@@ -271,15 +1140,35 @@ QSmartCard::QSmartCard(QObject *parent)
 	EC_KEY_METHOD_set_sign(d->ecmethod, sign, sign_setup, Private::ecdsa_do_sign);
 #endif
 
-	d->t.d->readers = QPCSC::instance().readers();
-	d->t.d->card = QStringLiteral("loading");
-	d->t.d->cards = QStringList() << d->t.d->card;
+	SCardEstablishContext(SCARD_SCOPE_USER, nullptr, nullptr, &d->context);
+	QSmartCardData t;
+	t.d->readers = QPCSC::instance().readers();
+	t.d->card = QStringLiteral("loading");
+	t.d->cards = QStringList() << t.d->card;
+	d->publish(t);
 }
 
 QSmartCard::~QSmartCard()
 {
 	requestInterruption();
+	d->wakeUp();
 	wait();
+	// Drop queued PIN and read commands, running ones still use d
+	QStringList pending;
+	{
+		QMutexLocker locker(&d->jobs->m);
+		d->jobs->closing = true;
+		pending = d->jobs->pending.keys();
+	}
+	for(const QString &reader: pending)
+		ReaderQueue::instance().cancel(reader);
+	{
+		QMutexLocker locker(&d->jobs->m);
+		while(d->jobs->running)
+			d->jobs->finished.wait(&d->jobs->m);
+	}
+	if(d->context)
+		SCardReleaseContext(d->context);
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L
 	RSA_meth_free(d->rsamethod);
 	EC_KEY_METHOD_free(d->ecmethod);
@@ -291,33 +1180,57 @@ QSmartCard::~QSmartCard()
 
 QSmartCard::ErrorType QSmartCard::change(QSmartCardData::PinType type, const QString &newpin, const QString &pin)
 {
-	QMutexLocker locker(&d->m);
-	QSharedPointer<QPCSCReader> reader(d->connect(d->t.reader()));
-	if(!reader)
-		return UnknownError;
-	QByteArray cmd = d->CHANGE;
-	cmd[3] = type == QSmartCardData::PukType ? 0 : type;
-	cmd[4] = char(pin.size() + newpin.size());
-	QPCSCReader::Result result;
-	if(d->t.isPinpad())
+	const QSmartCardData t = data();
+	return ReaderQueue::instance().exec(t.reader(), [&] { return d->changePin(t, type, newpin, pin); });
+}
+
+void QSmartCard::changeAsync(QSmartCardData::PinType type, const QString &newpin, const QString &pin)
+{
+	const QSmartCardData t = data();
+	d->enqueue(t.reader(), [=] {
+		Q_EMIT pinOperationFinished(type, d->changePin(t, type, newpin, pin));
+	});
+}
+
+QSmartCardData QSmartCard::data() const
+{
+	return d->current();
+}
+
+std::future<QSmartCardData> QSmartCard::fetch(QSmartCardData::DataGroups groups)
+{
+	QSmartCardData t = data();
+	if((t.loaded() & groups) == groups || !t.loaded().testFlag(QSmartCardData::IdentityGroup))
 	{
-		QEventLoop l;
-		std::thread([&]{
-			result = reader->transferCTL(cmd, false, d->language(), QSmartCardData::minPinLen(type));
-			l.quit();
-		}).detach();
-		l.exec();
+		std::promise<QSmartCardData> ready;
+		ready.set_value(t);
+		return ready.get_future();
 	}
-	else
-		result = reader->transfer(cmd + pin.toUtf8() + newpin.toUtf8());
-	return d->handlePinResult(reader.data(), result, true);
+	// Queued behind PIN commands of the same reader
+	return d->enqueue(t.reader(), [this, t, groups] {
+		QSmartCardData data = t;
+		{
+			Private::ReaderLocker locker(d, data.reader());
+			QSharedPointer<QPCSCReader> reader(d->connect(data.reader()));
+			if(!reader || !d->readCardData(reader.data(), data.d, nullptr, groups|QSmartCardData::IdentityGroup))
+				return this->data();
+		}
+		{
+			QMutexLocker locker(&d->m);
+			if(d->current().card() != data.card())
+				return data;
+			data = d->publishCard(data);
+			if(d->cache.contains(data.card()))
+				d->cache[data.card()] = data;
+		}
+		Q_EMIT dataChanged();
+		return data;
+	});
 }
 
-QSmartCardData QSmartCard::data() const { return d->t; }
-
 QSslKey QSmartCard::key() const
 {
-	QSslKey key = d->t.authCert().publicKey();
+	QSslKey key = data().authCert().publicKey();
 	if(!key.handle())
 		return key;
 	if (key.algorithm() == QSsl::Ec)
@@ -347,18 +1260,19 @@ QSslKey QSmartCard::key() const
 
 QSmartCard::ErrorType QSmartCard::login(QSmartCardData::PinType type)
 {
+	const QSmartCardData t = data();
 	PinDialog::PinFlags flags = PinDialog::Pin1Type;
 	QSslCertificate cert;
 	switch(type)
 	{
-	case QSmartCardData::Pin1Type: flags = PinDialog::Pin1Type; cert = d->t.authCert(); break;
-	case QSmartCardData::Pin2Type: flags = PinDialog::Pin2Type; cert = d->t.signCert(); break;
+	case QSmartCardData::Pin1Type: flags = PinDialog::Pin1Type; cert = t.authCert(); break;
+	case QSmartCardData::Pin2Type: flags = PinDialog::Pin2Type; cert = t.signCert(); break;
 	default: return UnknownError;
 	}
 
 	QScopedPointer<PinDialog> p;
 	QByteArray pin;
-	if(!d->t.isPinpad())
+	if(!t.isPinpad())
 	{
 		p.reset(new PinDialog(flags, cert, nullptr, qApp->activeWindow()));
 		if(!p->exec())
@@ -368,35 +1282,36 @@ QSmartCard::ErrorType QSmartCard::login(QSmartCardData::PinType type)
 	else
 		p.reset(new PinDialog(PinDialog::PinFlags(flags|PinDialog::PinpadFlag), cert, nullptr, qApp->activeWindow()));
 
-	d->m.lock();
-	d->reader = d->connect(d->t.reader());
+	// Keep reader locked until logout, other readers are still polled
+	d->session = d->readerLock(t.reader());
+	d->session->lock();
+	d->reader = d->connect(t.reader());
 	if(!d->reader)
 	{
-		d->m.unlock();
+		d->session->unlock();
+		d->session.clear();
+		d->wakeUp();
 		return UnknownError;
 	}
-	QByteArray cmd = d->VERIFY;
-	cmd[3] = type;
-	cmd[4] = char(pin.size());
+	d->sessionCard = t;
+	const QByteArray cmd = EstEID::VERIFY.withP2(type).withData({pin});
 	QPCSCReader::Result result;
-	if(d->t.isPinpad())
+	if(t.isPinpad())
 	{
-		std::thread([&]{
+		std::future<QPCSCReader::Result> pending = ReaderQueue::instance().enqueue(t.reader(), [&] {
 			Q_EMIT p->startTimer();
-			result = d->reader->transferCTL(cmd, true, d->language(), QSmartCardData::minPinLen(type));
+			QPCSCReader::Result response = d->reader->transferCTL(cmd, true, d->language(), QSmartCardData::minPinLen(type));
 			Q_EMIT p->finish(0);
-		}).detach();
+			return response;
+		});
 		p->exec();
+		result = pending.get();
 	}
 	else
-		result = d->reader->transfer(cmd + pin);
-	QSmartCard::ErrorType err = d->handlePinResult(d->reader.data(), result, false);
+		result = d->reader->transfer(cmd);
+	QSmartCard::ErrorType err = d->handlePinResult(d->reader.data(), t, result, type);
 	if(!result)
-	{
-		d->updateCounters(d->reader.data(), d->t.d);
-		d->reader.clear();
-		d->m.unlock();
-	}
+		logout();
 	return err;
 }
 
@@ -404,327 +1319,411 @@ void QSmartCard::logout()
 {
 	if(d->reader.isNull())
 		return;
-	d->updateCounters(d->reader.data(), d->t.d);
+	// Only signing and authentication change key usage counters
+	if(d->keyUsed)
+		d->refreshCounters(d->reader.data(), d->sessionCard, Private::UsageCounters);
+	d->keyUsed = false;
 	d->reader.clear();
-	d->m.unlock();
+	d->sessionCard = QSmartCardData();
+	d->session->unlock();
+	d->session.clear();
+	d->wakeUp();
 }
 
-QHash<quint8,QByteArray> QSmartCard::parseFCI(const QByteArray &data)
+QByteArray QSmartCard::readCert(QPCSCReader *reader, const QByteArray &fci, const QByteArray &cached)
 {
-	QHash<quint8,QByteArray> result;
-	for(QByteArray::const_iterator i = data.constBegin(); i != data.constEnd(); ++i)
+	// Largest Le accepted by reader and card, learned once
+	static QMutex lock;
+	static QHash<QString,int> maxLe;
+	const QString key = reader->name() + QLatin1Char('/') + QString::fromLatin1(reader->atr());
+
+	TLV fileSize = TLV::find(fci, 0x85);
+	int size = fileSize.length == 2 ? int(fileSize.toUInt()) : 0x0600;
+	int le = 0x100;
+	if(reader->protocol() == QPCSCReader::T1)
 	{
-		quint8 tag(*i), size(*++i);
-		result[tag] = QByteArray(i + 1, size);
-		switch(tag)
+		QMutexLocker locker(&lock);
+		le = maxLe.value(key, 0xFFFF);
+	}
+
+	QByteArray cert;
+	while(cert.size() < size)
+	{
+		// Size last request to file length, overreading fails on some cards
+		int chunk = qMin(size - cert.size(), le);
+		const CardCommand cmd = EstEID::READBINARY.withP1(quint8(cert.size() >> 8)).withP2(quint8(cert.size()));
+		QPCSCReader::Result result = reader->transfer(cmd.withLe(chunk));
+		if(!result && chunk > 0x100)
 		{
-		case 0x6F:
-		case 0x62:
-		case 0x64:
-		case 0xA1: continue;
-		default: i += size; break;
+			le = qMax(0x100, chunk / 2);
+			qDebug() << "Extended READ BINARY failed, using Le" << le;
+			QMutexLocker locker(&lock);
+			maxLe[key] = le;
+			continue;
 		}
+		if(!result || result.data.isEmpty())
+			return QByteArray();
+		cert += result.data;
+		// Serial is in first block, skip rest when it matches cached certificate
+		const int common = qMin(cert.size(), cached.size());
+		if(common > 0 && cert.left(common) == cached.left(common))
+			return cached;
 	}
-	return result;
+	return cert;
 }
 
-void QSmartCard::reload() { selectCard(d->t.card());  }
-
-void QSmartCard::run()
+void QSmartCard::reload()
 {
-	static const QHash<QByteArray,QSmartCardData::CardVersion> atrList{
-		{"3BFE9400FF80B1FA451F034573744549442076657220312E3043", QSmartCardData::VER_1_0}, /*ESTEID_V1_COLD_ATR*/
-		{"3B6E00FF4573744549442076657220312E30", QSmartCardData::VER_1_0}, /*ESTEID_V1_WARM_ATR*/
-		{"3BDE18FFC080B1FE451F034573744549442076657220312E302B", QSmartCardData::VER_1_0_2007}, /*ESTEID_V1_2007_COLD_ATR*/
-		{"3B5E11FF4573744549442076657220312E30", QSmartCardData::VER_1_0_2007}, /*ESTEID_V1_2007_WARM_ATR*/
-		{"3B6E00004573744549442076657220312E30", QSmartCardData::VER_1_1}, /*ESTEID_V1_1_COLD_ATR*/
-		{"3BFE1800008031FE454573744549442076657220312E30A8", QSmartCardData::VER_3_4}, /*ESTEID_V3_COLD_DEV1_ATR*/
-		{"3BFE1800008031FE45803180664090A4561B168301900086", QSmartCardData::VER_3_4}, /*ESTEID_V3_WARM_DEV1_ATR*/
-		{"3BFE1800008031FE45803180664090A4162A0083019000E1", QSmartCardData::VER_3_4}, /*ESTEID_V3_WARM_DEV2_ATR*/
-		{"3BFE1800008031FE45803180664090A4162A00830F9000EF", QSmartCardData::VER_3_4}, /*ESTEID_V3_WARM_DEV3_ATR*/
-		{"3BF9180000C00A31FE4553462D3443432D303181", QSmartCardData::VER_3_5}, /*ESTEID_V35_COLD_DEV1_ATR*/
-		{"3BF81300008131FE454A434F5076323431B7", QSmartCardData::VER_3_5}, /*ESTEID_V35_COLD_DEV2_ATR*/
-		{"3BFA1800008031FE45FE654944202F20504B4903", QSmartCardData::VER_3_5}, /*ESTEID_V35_COLD_DEV3_ATR*/
-		{"3BFE1800008031FE45803180664090A4162A00830F9000EF", QSmartCardData::VER_3_5}, /*ESTEID_V35_WARM_ATR*/
-		{"3BFE1800008031FE45803180664090A5102E03830F9000EF", QSmartCardData::VER_3_5}, /*UPDATER_TEST_CARDS*/
-	};
+	QString card;
+	{
+		QMutexLocker locker(&d->m);
+		card = d->current().card();
+		d->cache.remove(card);
+	}
+	selectCard(card);
+}
 
-	QByteArray cardid = d->READRECORD;
-	cardid[2] = 8;
+void QSmartCard::setPrefetch(QSmartCardData::DataGroups groups)
+{
+	d->prefetch.fetchAndStoreOrdered(int(groups | QSmartCardData::IdentityGroup));
+}
 
+void QSmartCard::run()
+{
+	d->waitForChange(QPCSC::instance().readers(), 0);
+	bool changed = true;
+	QStringList readers;
 	while(!isInterruptionRequested())
 	{
-		if(d->m.tryLock())
+		// Nothing has changed since last round, card data is up to date
+		const QStringList available = QPCSC::instance().readers();
+		if(!changed && available == readers)
 		{
-			// Get list of available cards
-			QMap<QString,QString> cards;
-			const QStringList readers = QPCSC::instance().readers();
-			if(![&] {
-				for(const QString &name: readers)
-				{
-					qDebug() << "Connecting to reader" << name;
-					QScopedPointer<QPCSCReader> reader(new QPCSCReader(name, &QPCSC::instance()));
-					if(!reader->isPresent())
-						continue;
+			changed = d->waitForChange(readers, INFINITE);
+			continue;
+		}
+		readers = available;
+		changed = false;
+		DWORD timeout = INFINITE;
+
+		// Get list of available cards
+		PollRound &round = d->round;
+		round.reset(readers.size());
+		for(int i = 0; i < readers.size(); ++i)
+		{
+			// Reuse card number when reader has not reported any events since last identification
+			const Private::ReaderState state = d->states.value(readers.at(i).toUtf8());
+			const Private::CardId id = d->ids.value(readers.at(i));
+			if(state.events() && id.events == state.events() && id.atr == state.atr)
+			{
+				round.readers[size_t(i)].polled = true;
+				round.readers[size_t(i)].card = id.card;
+			}
+			else
+				round.pending.push_back(i);
+		}
+		auto poll = [&](int i) {
+			// Reader is used or awaited by PIN or update operation, keep last known card
+			PollRound::Reader &reader = round.readers[size_t(i)];
+			QSharedPointer<QMutex> lock = d->readerLock(readers.at(i));
+			if(d->hasPendingJobs(readers.at(i)) || !lock->tryLock())
+			{
+				reader.busy = reader.polled = true;
+				reader.card = d->ids.value(readers.at(i)).card;
+				return;
+			}
+			reader.polled = d->readCardId(readers.at(i), reader.card);
+			lock->unlock();
+		};
+		if(round.pending.size() == 1)
+			poll(round.pending.front());
+		else
+		{
+			// Slow readers must not delay others, readers in use are not queued behind their commands
+			std::vector<std::future<void>> jobs;
+			for(int i: round.pending)
+			{
+				if(d->isReaderBusy(readers.at(i)))
+					poll(i);
+				else
+					jobs.push_back(ReaderQueue::instance().enqueue(readers.at(i), [&poll, i] { poll(i); }));
+			}
+			for(std::future<void> &job: jobs)
+				job.wait();
+		}
+		// Identification of busy readers is kept, others are updated in place
+		for(int i: round.pending)
+		{
+			const PollRound::Reader &reader = round.readers[size_t(i)];
+			const Private::ReaderState state = d->states.value(readers.at(i).toUtf8());
+			if(reader.busy)
+				continue;
+			if(reader.polled && state.events())
+				d->ids[readers.at(i)] = {state.atr, state.events(), reader.card};
+			else
+				d->ids.remove(readers.at(i));
+		}
+		for(QHash<QString,Private::CardId>::iterator i = d->ids.begin(); i != d->ids.end();)
+		{
+			if(readers.contains(i.key()))
+				++i;
+			else
+				i = d->ids.erase(i);
+		}
+		if(!round.collect(readers))
+		{
+			qDebug() << "Failed to poll card, try again next round";
+			d->waitForChange(readers, 5000);
+			changed = true;
+			continue;
+		}
 
-					if(!atrList.contains(reader->atr()))
-					{
-						qDebug() << "Unknown ATR" << reader->atr();
-						continue;
-					}
+		// cardlist has changed
+		round.sortCards(TokenData::cardsOrder);
+		const QStringList &order = round.order;
+		bool update = false;
+		QSmartCardData previous;
+		{
+			QMutexLocker locker(&d->m);
+			previous = d->current();
+			const bool removed = !previous.card().isEmpty() && !order.contains(previous.card());
+			const bool select = (removed || previous.card().isEmpty()) && !order.isEmpty();
+			// Unchanged data is not copied and published again
+			if(removed || select || previous.cards() != order || previous.readers() != readers)
+			{
+				QSmartCardData next = previous;
 
-					switch(reader->connectEx())
-					{
-					case 0x8010000CL: continue; //SCARD_E_NO_SMARTCARD
-					case 0:
-						if(reader->beginTransaction())
-							break;
-					default: return false;
-					}
+				// check if selected card is still in slot
+				if(removed)
+				{
+					update = true;
+					next.d = new QSmartCardDataPrivate();
+				}
 
-					QPCSCReader::Result result;
-					#define TRANSFERIFNOT(X) result = reader->transfer(X); \
-						if(result.err) return false; \
-						if(!result)
-
-					TRANSFERIFNOT(d->MASTER_FILE)
-					{	// Master file selection failed, test if it is updater applet
-						TRANSFERIFNOT(d->UPDATER_AID)
-							continue; // Updater applet not found
-						TRANSFERIFNOT(d->MASTER_FILE)
-						{	//Found updater applet but cannot select master file, select back 3.5
-							reader->transfer(d->AID35);
-							continue;
-						}
-					}
-					TRANSFERIFNOT(d->ESTEIDDF)
-						continue;
-					TRANSFERIFNOT(d->PERSONALDATA)
-						continue;
-					TRANSFERIFNOT(cardid)
-						continue;
-					QString nr = d->codec->toUnicode(result.data);
-					if(!nr.isEmpty())
-						cards[nr] = name;
+				next.d->cards = order;
+				next.d->readers = readers;
+
+				// if none is selected select first from cardlist
+				if(select)
+				{
+					next.d->card = next.cards().first();
+					next.d->clearData();
+					next.d->appletVersion.clear();
+					next.d->authCert = QSslCertificate();
+					next.d->signCert = QSslCertificate();
+					next.d->loaded = QSmartCardData::DataGroups();
+					update = true;
 				}
-				return true;
-			}())
-			{
-				qDebug() << "Failed to poll card, try again next round";
-				d->m.unlock();
-				sleep(5);
-				continue;
+				d->publish(next);
+				if(select)
+					Q_EMIT dataChanged();
 			}
+		}
 
-			// cardlist has changed
-			QStringList order = cards.keys();
-			std::sort(order.begin(), order.end(), TokenData::cardsOrder);
-			bool update = d->t.cards() != order || d->t.readers() != readers;
-
-			// check if selected card is still in slot
-			if(!d->t.card().isEmpty() && !order.contains(d->t.card()))
+		for(const QString &reader: readers)
+			if(!previous.readers().contains(reader))
+				Q_EMIT readerAdded(reader);
+		for(const QString &reader: previous.readers())
+			if(!readers.contains(reader))
+				Q_EMIT readerRemoved(reader);
+		for(const std::pair<QString,QString> &card: round.cards)
+			if(!previous.cards().contains(card.first))
+				Q_EMIT cardInserted(card.first, card.second);
+		// Placeholder published by constructor was never a card
+		for(const QString &id: previous.cards())
+			if(!round.contains(id) && id != QLatin1String("loading"))
+				Q_EMIT cardRemoved(id);
+
+		// read data of all inserted cards, other readers stay available meanwhile
+		QStringList missing;
+		{
+			QMutexLocker locker(&d->m);
+			for(QHash<QString,QSmartCardData>::iterator i = d->cache.begin(); i != d->cache.end();)
 			{
-				update = true;
-				d->t.d = new QSmartCardDataPrivate();
+				if(round.contains(i.key()))
+					++i;
+				else
+					i = d->cache.erase(i);
 			}
+			for(const QString &id: order)
+				if(!d->cache.contains(id))
+					missing << id;
+		}
 
-			d->t.d->cards = order;
-			d->t.d->readers = readers;
-
-			// if none is selected select first from cardlist
-			if(d->t.card().isEmpty() && !d->t.cards().isEmpty())
+		// show last known data of returning card until it is validated
+		std::vector<QSmartCardData> snapshots;
+		for(const QString &id: missing)
+			snapshots.push_back(d->loadSnapshot(id));
+		{
+			QString provisional;
+			QSmartCardData snapshot;
+			{
+				QMutexLocker locker(&d->m);
+				const QSmartCardData current = d->current();
+				int i = missing.indexOf(current.card());
+				if(current.isNull() && i != -1 && !snapshots[size_t(i)].isNull())
+				{
+					// Counters change without the certificates changing, they are shown only after reading
+					snapshot = snapshots[size_t(i)];
+					snapshot.d->reader = round.reader(snapshot.card());
+					snapshot.d->pinpad = d->pooled(snapshot.d->reader)->isPinPad();
+					snapshot.d->loaded &= ~QSmartCardData::DataGroups(QSmartCardData::CountersGroup);
+					snapshot = d->publishCard(snapshot);
+					provisional = snapshot.card();
+				}
+			}
+			if(!provisional.isEmpty())
 			{
-				QSharedDataPointer<QSmartCardDataPrivate> t = d->t.d;
-				t->card = d->t.cards().first();
-				t->data.clear();
-				t->appletVersion.clear();
-				t->authCert = QSslCertificate();
-				t->signCert = QSslCertificate();
-				d->t.d = t;
-				update = true;
 				Q_EMIT dataChanged();
+				Q_EMIT certificateChanged(QSmartCardData::Pin1Type, snapshot.authCert());
+				Q_EMIT certificateChanged(QSmartCardData::Pin2Type, snapshot.signCert());
 			}
+		}
 
-			// read card data
-			if(d->t.cards().contains(d->t.card()) && d->t.isNull())
+		std::vector<QSmartCardData> results(size_t(missing.size()));
+		std::vector<char> failed(size_t(missing.size()), false);
+		auto read = [&](int i) {
+			// Reader is used or awaited by PIN or update operation, read next round
+			QSharedPointer<QMutex> lock = d->readerLock(round.reader(missing.at(i)));
+			if(d->hasPendingJobs(round.reader(missing.at(i))) || !lock->tryLock())
+				return;
+			QSharedPointer<QPCSCReader> reader(d->connect(round.reader(missing.at(i))));
+			QSmartCardData data;
+			data.d->card = missing.at(i);
+			const QSmartCardData &snapshot = snapshots[size_t(i)];
+			const QSmartCardData::DataGroups prefetch(d->prefetch.loadAcquire());
+			// Without snapshot publish name and document number first, then certificates and counters
+			std::vector<QSmartCardData::DataGroups> stages{prefetch};
+			if(snapshot.isNull())
+				stages = {
+					prefetch & (QSmartCardData::IdentityGroup|QSmartCardData::PersonalGroup|QSmartCardData::AppletVersionGroup),
+					prefetch & (QSmartCardData::AuthCertGroup|QSmartCardData::SignCertGroup),
+					prefetch & QSmartCardData::CountersGroup,
+				};
+			failed[size_t(i)] = reader.isNull();
+			for(size_t stage = 0; !failed[size_t(i)] && stage < stages.size(); ++stage)
 			{
-				update = true;
-				QSharedPointer<QPCSCReader> reader(d->connect(cards.value(d->t.card())));
-				if(!reader.isNull())
+				if(!stages[stage])
+					continue;
+				if(!d->readCardData(reader.data(), data.d, snapshot.isNull() ? nullptr : snapshot.d.constData(), stages[stage]))
+					failed[size_t(i)] = true;
+				else if(stage + 1 < stages.size())
 				{
-					QSharedDataPointer<QSmartCardDataPrivate> t = d->t.d;
-					t->reader = reader->name();
-					t->pinpad = reader->isPinPad();
-					t->version = atrList.value(reader->atr(), QSmartCardData::VER_INVALID);
-					if(t->version > QSmartCardData::VER_1_1)
-					{
-						if(reader->transfer(d->AID30).resultOk())
-							t->version = QSmartCardData::VER_3_0;
-						else if(reader->transfer(d->AID34).resultOk())
-							t->version = QSmartCardData::VER_3_4;
-						else if(reader->transfer(d->UPDATER_AID).resultOk())
-						{
-							t->version = QSmartCardData::CardVersion(t->version|QSmartCardData::VER_HASUPDATER);
-							//Prefer EstEID applet when if it is usable
-							if(!reader->transfer(d->AID35) ||
-								!reader->transfer(d->MASTER_FILE))
-							{
-								reader->transfer(d->UPDATER_AID);
-								t->version = QSmartCardData::VER_USABLEUPDATER;
-							}
-						}
-					}
-
-					bool tryAgain = !d->updateCounters(reader.data(), t);
-					if(reader->transfer(d->PERSONALDATA).resultOk())
+					// Shared data is copied on write, published stage stays unchanged
+					bool selected = false;
 					{
-						QByteArray cmd = d->READRECORD;
-						for(int data = QSmartCardData::SurName; data != QSmartCardData::Comment4; ++data)
-						{
-							cmd[2] = char(data + 1);
-							QPCSCReader::Result result = reader->transfer(cmd);
-							if(!result)
-							{
-								tryAgain = true;
-								break;
-							}
-							QString record = d->codec->toUnicode(result.data.trimmed());
-							if(record == QChar(0))
-								record.clear();
-							switch(data)
-							{
-							case QSmartCardData::BirthDate:
-							case QSmartCardData::Expiry:
-							case QSmartCardData::IssueDate:
-								t->data[QSmartCardData::PersonalDataType(data)] = QDate::fromString(record, QStringLiteral("dd.MM.yyyy"));
-								break;
-							default:
-								t->data[QSmartCardData::PersonalDataType(data)] = record;
-								break;
-							}
-						}
+						QMutexLocker locker(&d->m);
+						selected = d->current().card() == data.card();
+						if(selected)
+							d->publishCard(data);
 					}
-
-					auto readCert = [&](const QByteArray &file) {
-						QPCSCReader::Result data = reader->transfer(file + APDU(reader->protocol() == QPCSCReader::T1 ? "00" : ""));
-						if(!data)
-							return QSslCertificate();
-						QHash<quint8,QByteArray> fci = parseFCI(data.data);
-						int size = fci.contains(0x85) ? fci[0x85][0] << 8 | fci[0x85][1] : 0x0600;
-						QByteArray cert;
-						while(cert.size() < size)
-						{
-							QByteArray cmd = d->READBINARY;
-							cmd[2] = char(cert.size() >> 8);
-							cmd[3] = char(cert.size());
-							data = reader->transfer(cmd);
-							if(!data)
-							{
-								tryAgain = true;
-								return QSslCertificate();
-							}
-							cert += data.data;
-						}
-						return QSslCertificate(cert, QSsl::Der);
-					};
-					t->authCert = readCert(d->AUTHCERT);
-					t->signCert = readCert(d->SIGNCERT);
-
-					QPCSCReader::Result data = reader->transfer(d->APPLETVER);
-					if (data.resultOk())
-					{
-						for(int i = 0; i < data.data.size(); ++i)
-						{
-							if(i == 0)
-								t->appletVersion = QString::number(quint8(data.data[i]));
-							else
-								t->appletVersion += QString(QStringLiteral(".%1")).arg(quint8(data.data[i]));
-						}
-					}
-
-					t->data[QSmartCardData::Email] = t->authCert.subjectAlternativeNames().values(QSsl::EmailEntry).value(0);
-					if(t->authCert.type() & SslCertificate::DigiIDType)
-					{
-						t->data[QSmartCardData::SurName] = t->authCert.toString(QStringLiteral("SN"));
-						t->data[QSmartCardData::FirstName1] = t->authCert.toString(QStringLiteral("GN"));
-						t->data[QSmartCardData::FirstName2] = QString();
-						t->data[QSmartCardData::Id] = t->authCert.subjectInfo("serialNumber");
-						t->data[QSmartCardData::BirthDate] = IKValidator::birthDate(t->authCert.subjectInfo("serialNumber"));
-						t->data[QSmartCardData::IssueDate] = t->authCert.effectiveDate();
-						t->data[QSmartCardData::Expiry] = t->authCert.expiryDate();
-					}
-					if(tryAgain)
-					{
-						qDebug() << "Failed to read card info, try again next round";
-						update = false;
-					}
-					else
-						d->t.d = t;
+					if(selected)
+						Q_EMIT dataChanged();
 				}
 			}
+			// Reissued document, forget personal data of the old one even when the read did not complete
+			if(!snapshot.isNull() && data.loaded().testFlag(QSmartCardData::AuthCertGroup) &&
+				data.loaded().testFlag(QSmartCardData::SignCertGroup) &&
+				(data.authCert() != snapshot.authCert() || data.signCert() != snapshot.signCert()))
+				d->dropSnapshot(data.card());
+			if(!failed[size_t(i)])
+			{
+				results[size_t(i)] = data;
+				d->saveSnapshot(data);
+			}
+			reader.clear();
+			lock->unlock();
+		};
+		if(missing.size() == 1)
+			read(0);
+		else if(!missing.isEmpty())
+		{
+			std::vector<std::future<void>> jobs;
+			for(int i = 0; i < missing.size(); ++i)
+			{
+				const QString reader = round.reader(missing.at(i));
+				if(d->isReaderBusy(reader))
+					read(i);
+				else
+					jobs.push_back(ReaderQueue::instance().enqueue(reader, [&read, i] { read(i); }));
+			}
+			for(std::future<void> &job: jobs)
+				job.wait();
+		}
+		if(std::find(failed.cbegin(), failed.cend(), true) != failed.cend())
+		{
+			qDebug() << "Failed to read card info, try again next round";
+			timeout = 5000;
+		}
 
-			// update data if something has changed
-			if(update)
-				Q_EMIT dataChanged();
-			d->m.unlock();
+		QSmartCardData data;
+		{
+			QMutexLocker locker(&d->m);
+			for(const QSmartCardData &result: results)
+			{
+				if(!result.card().isEmpty() && round.contains(result.card()))
+					d->cache[result.card()] = result;
+			}
+			const QSmartCardData current = d->current();
+			if((current.isNull() || missing.contains(current.card())) && d->cache.contains(current.card()))
+			{
+				data = d->publishCard(d->cache.value(current.card()));
+				update = true;
+			}
 		}
-		sleep(5);
+		if(!data.card().isEmpty())
+		{
+			Q_EMIT certificateChanged(QSmartCardData::Pin1Type, data.authCert());
+			Q_EMIT certificateChanged(QSmartCardData::Pin2Type, data.signCert());
+		}
+		for(const QSmartCardData &result: results)
+		{
+			if(!result.card().isEmpty())
+				Q_EMIT cardDataReady(result.card() == data.card() ? data : result);
+		}
+
+		// update data if something has changed
+		if(update)
+			Q_EMIT dataChanged();
+		changed = d->waitForChange(readers, timeout) || timeout != INFINITE;
 	}
 }
 
 void QSmartCard::selectCard(const QString &card)
 {
 	QMutexLocker locker(&d->m);
-	QSharedDataPointer<QSmartCardDataPrivate> t = d->t.d;
-	t->card = card;
-	t->data.clear();
-	t->appletVersion.clear();
-	t->authCert = QSslCertificate();
-	t->signCert = QSslCertificate();
-	d->t.d = t;
+	// Card read in background, switch instantly
+	if(d->cache.contains(card))
+	{
+		const QSmartCardData cached = d->publishCard(d->cache.value(card));
+		locker.unlock();
+		Q_EMIT dataChanged();
+		Q_EMIT certificateChanged(QSmartCardData::Pin1Type, cached.authCert());
+		Q_EMIT certificateChanged(QSmartCardData::Pin2Type, cached.signCert());
+		return;
+	}
+	QSmartCardData next = d->current();
+	next.d->card = card;
+	next.d->clearData();
+	next.d->appletVersion.clear();
+	next.d->authCert = QSslCertificate();
+	next.d->signCert = QSslCertificate();
+	next.d->loaded = QSmartCardData::DataGroups();
+	d->publish(next);
 	Q_EMIT dataChanged();
+	d->wakeUp();
 }
 
 QSmartCard::ErrorType QSmartCard::unblock(QSmartCardData::PinType type, const QString &pin, const QString &puk)
 {
-	QMutexLocker locker(&d->m);
-	QSharedPointer<QPCSCReader> reader(d->connect(d->t.reader()));
-	if(!reader)
-		return UnknownError;
-
-	QByteArray cmd = d->VERIFY;
-	QPCSCReader::Result result;
-
-	if(!d->t.isPinpad())
-	{
-		//Verify PUK. Not for pinpad.
-		cmd[3] = 0;
-		cmd[4] = char(puk.size());
-		result = reader->transfer(cmd + puk.toUtf8());
-		if(!result)
-			return d->handlePinResult(reader.data(), result, false);
-	}
-
-	// Make sure pin is locked. ID card is designed so that only blocked PIN could be unblocked with PUK!
-	cmd[3] = type;
-	cmd[4] = char(pin.size() + 1);
-	for(quint8 i = 0; i <= d->t.retryCount(type); ++i)
-		reader->transfer(cmd + QByteArray(pin.size(), '0') + QByteArray::number(i));
+	const QSmartCardData t = data();
+	return ReaderQueue::instance().exec(t.reader(), [&] { return d->unblockPin(t, type, pin, puk); });
+}
 
-	//Replace PIN with PUK
-	cmd = d->REPLACE;
-	cmd[3] = type;
-	cmd[4] = char(puk.size() + pin.size());
-	if(d->t.isPinpad())
-	{
-		QEventLoop l;
-		std::thread([&]{
-			result = reader->transferCTL(cmd, false, d->language(), QSmartCardData::minPinLen(type));
-			l.quit();
-		}).detach();
-		l.exec();
-	}
-	else
-		result = reader->transfer(cmd + puk.toUtf8() + pin.toUtf8());
-	return d->handlePinResult(reader.data(), result, true);
+void QSmartCard::unblockAsync(QSmartCardData::PinType type, const QString &pin, const QString &puk)
+{
+	const QSmartCardData t = data();
+	d->enqueue(t.reader(), [=] {
+		Q_EMIT pinOperationFinished(type, d->unblockPin(t, type, pin, puk));
+	});
 }
@@ -23,8 +23,12 @@
 
 #include <QSharedDataPointer>
 
+#include <future>
+
 class SslCertificate;
+class QPCSCReader;
 class QSmartCardDataPrivate;
+class QSslCertificate;
 class QSslKey;
 
 class QSmartCardData
@@ -69,6 +73,17 @@ public:
 		VER_USABLEUPDATER,
 		VER_HASUPDATER = 128
 	};
+	enum DataGroup
+	{
+		IdentityGroup = 1 << 0,
+		PersonalGroup = 1 << 1,
+		AuthCertGroup = 1 << 2,
+		SignCertGroup = 1 << 3,
+		CountersGroup = 1 << 4,
+		AppletVersionGroup = 1 << 5,
+		AllGroups = 0x3F
+	};
+	Q_DECLARE_FLAGS(DataGroups, DataGroup)
 
 	QSmartCardData();
 	QSmartCardData( const QSmartCardData &other );
@@ -83,6 +98,7 @@ public:
 	QStringList readers() const;
 
 	bool isNull() const;
+	DataGroups loaded() const;
 	bool isPinpad() const;
 	bool isSecurePinpad() const;
 	bool isValid() const;
@@ -105,6 +121,8 @@ private:
 	friend class QSmartCardPrivate;
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(QSmartCardData::DataGroups)
+
 
 
 class QSmartCard: public QThread
@@ -127,17 +145,30 @@ public:
 	~QSmartCard();
 
 	ErrorType change( QSmartCardData::PinType type, const QString &newpin, const QString &pin );
+	void changeAsync(QSmartCardData::PinType type, const QString &newpin, const QString &pin);
 	QSmartCardData data() const;
+	std::future<QSmartCardData> fetch(QSmartCardData::DataGroups groups);
 	QSslKey key() const;
 	ErrorType login( QSmartCardData::PinType type );
 	void logout();
 	void reload();
+	void setPrefetch(QSmartCardData::DataGroups groups);
 	ErrorType unblock( QSmartCardData::PinType type, const QString &pin, const QString &puk );
+	void unblockAsync(QSmartCardData::PinType type, const QString &pin, const QString &puk);
 
-	static QHash<quint8,QByteArray> parseFCI(const QByteArray &data);
+	static QByteArray readCert(QPCSCReader *reader, const QByteArray &fci, const QByteArray &cached = QByteArray());
 
 signals:
 	void dataChanged();
+	void readerAdded(const QString &reader);
+	void readerRemoved(const QString &reader);
+	void cardInserted(const QString &card, const QString &reader);
+	void cardRemoved(const QString &card);
+	void cardDataReady(const QSmartCardData &data);
+	void countersChanged(QSmartCardData::PinType type, quint8 retry, ulong usage);
+	void certificateChanged(QSmartCardData::PinType type, const QSslCertificate &cert);
+	void pinOperationProgress(QSmartCardData::PinType type, int step, int steps);
+	void pinOperationFinished(QSmartCardData::PinType type, QSmartCard::ErrorType error);
 
 private Q_SLOTS:
 	void selectCard( const QString &card );
@@ -150,3 +181,7 @@ private:
 
 	friend class MainWindow;
 };
+
+Q_DECLARE_METATYPE(QSmartCardData)
+Q_DECLARE_METATYPE(QSmartCardData::PinType)
+Q_DECLARE_METATYPE(QSmartCard::ErrorType)
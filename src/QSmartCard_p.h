@@ -18,27 +18,149 @@
  */
 
 #include "QSmartCard.h"
+#include "PollRound.h"
+#include "ReaderQueue.h"
 
 #include <common/QPCSC.h>
 #include <common/SslCertificate.h>
 
+#include <QtCore/QAtomicInt>
+#include <QtCore/QDateTime>
 #include <QtCore/QMutex>
+#include <QtCore/QSet>
 #include <QtCore/QStringList>
-#include <QtCore/QTextCodec>
 #include <QtCore/QVariant>
+#include <QtCore/QWaitCondition>
 
 #include <openssl/ecdsa.h>
 #include <openssl/rsa.h>
 
-#define APDU QByteArray::fromHex
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#ifdef Q_OS_WIN
+#include <winscard.h>
+// Reader names are UTF-8 byte strings, members and calls must use the ANSI API also with UNICODE
+#undef SCARD_READERSTATE
+#undef SCardGetStatusChange
+#define SCARD_READERSTATE SCARD_READERSTATEA
+#define SCardGetStatusChange SCardGetStatusChangeA
+#else
+#include <PCSC/wintypes.h>
+#include <PCSC/winscard.h>
+#endif
 
 class QSmartCard::Private
 {
 public:
+	enum CounterType
+	{
+		RetryCounters = 1,
+		UsageCounters = 2
+	};
+	struct ReaderState
+	{
+		DWORD state = SCARD_STATE_UNAWARE;
+		QByteArray atr;
+		quint16 events() const { return quint16(state >> 16); }
+	};
+	struct CardId
+	{
+		QByteArray atr;
+		quint16 events = 0;
+		QString card;
+	};
+	struct Selection
+	{
+		bool valid = false;
+		QByteArray file; // path from MF
+		QByteArray env; // restored security environment
+	};
+	struct PooledReader
+	{
+		QSharedPointer<QPCSCReader> reader;
+		ReaderState state;
+		Selection selection;
+	};
+	// Commands queued for QSmartCard, outlives it so that dropped jobs do not touch freed data
+	struct Jobs
+	{
+		QMutex m;
+		QWaitCondition finished;
+		QHash<QString,int> pending; // queued or running per reader
+		int running = 0;
+		bool closing = false;
+
+		bool start(const QString &reader);
+		void finish(const QString &reader);
+		void stop();
+	};
+	class ReaderLocker
+	{
+	public:
+		ReaderLocker(Private *d, const QString &reader): d(d), m(d->readerLock(reader)) { m->lock(); }
+		~ReaderLocker() { m->unlock(); d->wakeUp(); }
+	private:
+		Q_DISABLE_COPY(ReaderLocker)
+		Private *d;
+		QSharedPointer<QMutex> m;
+	};
+
+	template<class F>
+	auto enqueue(const QString &reader, F job) -> std::future<decltype(job())>
+	{
+		std::shared_ptr<Jobs> state = jobs;
+		{
+			QMutexLocker locker(&state->m);
+			++state->pending[reader];
+		}
+		return ReaderQueue::instance().enqueue(reader, [this, state, reader, job]() -> decltype(job()) {
+			if(!state->start(reader))
+				return decltype(job())();
+			// Polling skips readers with pending jobs, wake it after the count drops;
+			// the destructor waits for stop() so this is still valid here
+			std::shared_ptr<void> finish(nullptr, [&](void *) {
+				state->finish(reader);
+				wakeUp();
+				state->stop();
+			});
+			return job();
+		});
+	}
+	bool hasPendingJobs(const QString &reader);
+	QSmartCard::ErrorType changePin(const QSmartCardData &t, QSmartCardData::PinType type,
+		const QString &newpin, const QString &pin);
 	QSharedPointer<QPCSCReader> connect(const QString &reader);
-	QSmartCard::ErrorType handlePinResult(QPCSCReader *reader, const QPCSCReader::Result &response, bool forceUpdate);
+	void drop(const QString &reader);
+	void dropSnapshot(const QString &card) const;
+	QSmartCard::ErrorType handlePinResult(QPCSCReader *reader, const QSmartCardData &t, const QPCSCReader::Result &response,
+		QSmartCardData::PinType type, QSmartCardData::PinType unblocked = QSmartCardData::PinType(0));
+	bool isReaderBusy(const QString &reader);
 	quint16 language() const;
-	bool updateCounters(QPCSCReader *reader, QSmartCardDataPrivate *d);
+	QSmartCardData loadSnapshot(const QString &card) const;
+	QSharedPointer<QPCSCReader> pooled(const QString &reader);
+	bool readCardData(QPCSCReader *reader, QSmartCardDataPrivate *t, const QSmartCardDataPrivate *snapshot = nullptr,
+		QSmartCardData::DataGroups groups = QSmartCardData::AllGroups);
+	bool readCardId(const QString &name, QString &card);
+	QSmartCardData current() const;
+	void publish(const QSmartCardData &data);
+	QSmartCardData publishCard(QSmartCardData data);
+	QSharedPointer<QMutex> readerLock(const QString &reader);
+	void publishCounters(const QSmartCardData &data, int types);
+	void refreshCounters(QPCSCReader *reader, const QSmartCardData &t, int types = RetryCounters|UsageCounters);
+	bool runPlan(QPCSCReader *reader, QSmartCardDataPrivate *t, QSmartCardData::DataGroups groups,
+		const QSmartCardDataPrivate *snapshot = nullptr, quint32 ops = ~0U);
+	void saveSnapshot(const QSmartCardData &data) const;
+	QPCSCReader::Result select(QPCSCReader *reader, QSmartCardData::CardVersion version, const QByteArray &path, bool fci = false);
+	Selection selection(QPCSCReader *reader);
+	void setSelection(QPCSCReader *reader, const Selection &selection);
+	QPCSCReader::Result transfer(QPCSCReader *reader, const QByteArray &cmd);
+	QSmartCard::ErrorType unblockPin(const QSmartCardData &t, QSmartCardData::PinType type,
+		const QString &pin, const QString &puk);
+	bool waitForChange(const QStringList &readers, DWORD timeout);
+	void wakeUp();
 
 	static QByteArray sign(const QByteArray &dgst, Private *d);
 	static int rsa_sign(int type, const unsigned char *m, unsigned int m_len,
@@ -46,9 +168,31 @@ public:
 	static ECDSA_SIG* ecdsa_do_sign(const unsigned char *dgst, int dgst_len,
 		const BIGNUM *inv, const BIGNUM *rp, EC_KEY *eckey);
 
+	QSmartCard		*q = nullptr;
 	QSharedPointer<QPCSCReader> reader;
-	QMutex			m;
-	QSmartCardData	t;
+	QSharedPointer<QMutex> session;
+	QSmartCardData	sessionCard; // card of the logged in reader session
+	QMutex			m; // serializes writers of t and guards cache
+	std::shared_ptr<const QSmartCardData> t = std::make_shared<const QSmartCardData>();
+	SCARDCONTEXT	context = 0;
+	QHash<QByteArray,ReaderState> states;
+	QHash<QString,CardId> ids;
+	PollRound		round; // used by poll thread only
+	QHash<QString,QSmartCardData> cache;
+	QHash<QString,PooledReader> pool;
+	QHash<QString,QSharedPointer<QMutex>> locks;
+	std::shared_ptr<Jobs> jobs = std::make_shared<Jobs>();
+	QSet<QByteArray> noPathSelect;
+	QMutex			poolLock;
+	QAtomicInt		wake;
+	QStringList		waitReaders;
+	std::vector<QByteArray> waitNames;
+	std::vector<SCARD_READERSTATE> waitList;
+	bool			waitPnp = true;
+	bool			waitStale = true;
+	QAtomicInt		prefetch{QSmartCardData::AllGroups};
+	bool			pnp = true;
+	bool			keyUsed = false;
 #if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
 	RSA_METHOD		rsamethod = *RSA_get_default_method();
 	ECDSA_METHOD	*ecmethod = ECDSA_METHOD_new(nullptr);
@@ -56,39 +200,72 @@ public:
 	RSA_METHOD		*rsamethod = RSA_meth_dup(RSA_get_default_method());
 	EC_KEY_METHOD	*ecmethod = EC_KEY_METHOD_new(EC_KEY_get_default_method());
 #endif
-	QTextCodec		*codec = QTextCodec::codecForName("Windows-1252");
 
-	const QByteArray AID30 = APDU("00A40400 10 D2330000010000010000000000000000");
-	const QByteArray AID34 = APDU("00A40400 0E F04573744549442076657220312E");
-	const QByteArray AID35 = APDU("00A40400 0F D23300000045737445494420763335");
-	const QByteArray UPDATER_AID =	APDU("00A40400 0A D2330000005550443101");
-	const QByteArray MASTER_FILE =	APDU("00A4000C");// 00"); // Compatibilty for some cards
-	const QByteArray ESTEIDDF =		APDU("00A4010C 02 EEEE");
-	const QByteArray PERSONALDATA =	APDU("00A4020C 02 5044");
-	const QByteArray AUTHCERT =		APDU("00A40200 02 AACE");
-	const QByteArray SIGNCERT =		APDU("00A40200 02 DDCE");
-	const QByteArray KEYPOINTER =	APDU("00A4020C 02 0033");
-	const QByteArray KEYUSAGE =		APDU("00A4020C 02 0013");
-	const QByteArray PINRETRY =		APDU("00A4020C 02 0016");
-	const QByteArray READBINARY =	APDU("00B00000 00");
-	const QByteArray READRECORD =	APDU("00B20004 00");
-	const QByteArray SECENV1 =		APDU("0022F301");// 00"); // Compatibilty for some cards
-	const QByteArray SECENV3 =		APDU("0022F303 00");
-	const QByteArray CHANGE =		APDU("00240000 00");
-	const QByteArray REPLACE =		APDU("002C0000 00");
-	const QByteArray VERIFY =		APDU("00200000 00");
-	const QByteArray APPLETVER =	APDU("00CA0100 00");
+	// Static data, copies share it without allocating
+	const QByteArray AID30 = QByteArrayLiteral("\x00\xA4\x04\x00\x10\xD2\x33\x00\x00\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00\x00");
+	const QByteArray AID34 = QByteArrayLiteral("\x00\xA4\x04\x00\x0E\xF0\x45\x73\x74\x45\x49\x44\x20\x76\x65\x72\x20\x31\x2E");
+	const QByteArray AID35 = QByteArrayLiteral("\x00\xA4\x04\x00\x0F\xD2\x33\x00\x00\x00\x45\x73\x74\x45\x49\x44\x20\x76\x33\x35");
+	const QByteArray UPDATER_AID =	QByteArrayLiteral("\x00\xA4\x04\x00\x0A\xD2\x33\x00\x00\x00\x55\x50\x44\x31\x01");
+	const QByteArray MASTER_FILE =	QByteArrayLiteral("\x00\xA4\x00\x0C");// 00"); // Compatibilty for some cards
+	const QByteArray ESTEIDDF =		QByteArrayLiteral("\x00\xA4\x01\x0C\x02\xEE\xEE");
+	const QByteArray PERSONALDATA =	QByteArrayLiteral("\x00\xA4\x02\x0C\x02\x50\x44");
+	const QByteArray SECENV1 =		QByteArrayLiteral("\x00\x22\xF3\x01");// 00"); // Compatibilty for some cards
+	const QByteArray SECENV3 =		QByteArrayLiteral("\x00\x22\xF3\x03\x00");
+	const QByteArray KEYREF =		QByteArrayLiteral("\x00\x22\x41\xB8\x02\x83\x00"); //Key reference, 8303801100
+	const QByteArray SIGNENV =		SECENV1 + KEYREF;
+	const QByteArray APPLETVER =	QByteArrayLiteral("\x00\xCA\x01\x00\x00");
 };
 
 class QSmartCardDataPrivate: public QSharedData
 {
 public:
+	static bool isDate(QSmartCardData::PersonalDataType type)
+	{
+		return type == QSmartCardData::BirthDate || type == QSmartCardData::Expiry || type == QSmartCardData::IssueDate;
+	}
+	QVariant value(QSmartCardData::PersonalDataType type) const
+	{
+		return isDate(type) ? QVariant(dates[type]) : QVariant(text[type]);
+	}
+	void setValue(QSmartCardData::PersonalDataType type, const QVariant &value)
+	{
+		if(isDate(type))
+			dates[type] = value.toDateTime();
+		else
+			text[type] = value.toString();
+	}
+	bool hasData() const
+	{
+		return std::any_of(std::begin(text), std::end(text), [](const QString &value) { return !value.isEmpty(); }) ||
+			std::any_of(std::begin(dates), std::end(dates), [](const QDateTime &value) { return value.isValid(); });
+	}
+	void clearData()
+	{
+		std::fill(std::begin(text), std::end(text), QString());
+		std::fill(std::begin(dates), std::end(dates), QDateTime());
+	}
+	void copyData(const QSmartCardDataPrivate &other)
+	{
+		std::copy(std::begin(other.text), std::end(other.text), std::begin(text));
+		std::copy(std::begin(other.dates), std::end(other.dates), std::begin(dates));
+	}
+	void copyCounters(const QSmartCardDataPrivate &other, bool retries, bool usages)
+	{
+		if(retries)
+			std::copy(std::begin(other.retry), std::end(other.retry), std::begin(retry));
+		if(usages)
+			std::copy(std::begin(other.usage), std::end(other.usage), std::begin(usage));
+	}
+
 	QString card, reader, appletVersion;
 	QStringList cards, readers;
-	QHash<QSmartCardData::PersonalDataType,QVariant> data;
+	// Indexed by PersonalDataType and PinType
+	QString text[QSmartCardData::Email + 1];
+	QDateTime dates[QSmartCardData::Email + 1];
 	SslCertificate authCert, signCert;
-	QHash<QSmartCardData::PinType,quint8> retry;
-	QHash<QSmartCardData::PinType,ulong> usage;
+	quint8 retry[QSmartCardData::PukType + 1] = {};
+	ulong usage[QSmartCardData::PukType + 1] = {};
 	QSmartCardData::CardVersion version = QSmartCardData::VER_INVALID;
+	QSmartCardData::DataGroups loaded;
 	bool pinpad = false;
 };
@@ -0,0 +1,125 @@
+/*
+ * QEstEidUtil
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "ReaderQueue.h"
+
+#include <QtCore/QHash>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+class ReaderQueuePrivate
+{
+public:
+	struct Worker
+	{
+		std::mutex m;
+		std::condition_variable cond;
+		std::deque<std::function<void()>> jobs;
+		bool stop = false;
+		std::thread thread;
+	};
+
+	static void run(Worker *worker);
+
+	std::mutex m;
+	QHash<QString,std::shared_ptr<Worker>> workers;
+};
+
+void ReaderQueuePrivate::run(Worker *worker)
+{
+	std::unique_lock<std::mutex> lock(worker->m);
+	Q_FOREVER
+	{
+		worker->cond.wait(lock, [worker] { return worker->stop || !worker->jobs.empty(); });
+		// Pending jobs are finished before stopping
+		if(worker->jobs.empty())
+			return;
+		std::function<void()> job = std::move(worker->jobs.front());
+		worker->jobs.pop_front();
+		lock.unlock();
+		job();
+		job = nullptr;
+		lock.lock();
+	}
+}
+
+ReaderQueue::ReaderQueue()
+	: d(new ReaderQueuePrivate)
+{}
+
+ReaderQueue::~ReaderQueue()
+{
+	for(const std::shared_ptr<ReaderQueuePrivate::Worker> &worker: d->workers)
+	{
+		{
+			std::lock_guard<std::mutex> lock(worker->m);
+			worker->stop = true;
+		}
+		worker->cond.notify_one();
+		worker->thread.join();
+	}
+	delete d;
+}
+
+void ReaderQueue::cancel(const QString &reader)
+{
+	std::shared_ptr<ReaderQueuePrivate::Worker> worker;
+	{
+		std::lock_guard<std::mutex> lock(d->m);
+		worker = d->workers.value(reader);
+	}
+	if(!worker)
+		return;
+	// Released outside of lock, their futures report broken promise
+	std::deque<std::function<void()>> jobs;
+	{
+		std::lock_guard<std::mutex> lock(worker->m);
+		jobs.swap(worker->jobs);
+	}
+}
+
+ReaderQueue& ReaderQueue::instance()
+{
+	static ReaderQueue queue;
+	return queue;
+}
+
+void ReaderQueue::post(const QString &reader, std::function<void()> job)
+{
+	std::shared_ptr<ReaderQueuePrivate::Worker> worker;
+	{
+		std::lock_guard<std::mutex> lock(d->m);
+		std::shared_ptr<ReaderQueuePrivate::Worker> &entry = d->workers[reader];
+		if(!entry)
+		{
+			entry = std::make_shared<ReaderQueuePrivate::Worker>();
+			entry->thread = std::thread(&ReaderQueuePrivate::run, entry.get());
+		}
+		worker = entry;
+	}
+	{
+		std::lock_guard<std::mutex> lock(worker->m);
+		worker->jobs.push_back(std::move(job));
+	}
+	worker->cond.notify_one();
+}
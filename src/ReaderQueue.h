@@ -0,0 +1,74 @@
+/*
+ * QEstEidUtil
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#pragma once
+
+#include <QtCore/QEventLoop>
+#include <QtCore/QString>
+
+#include <functional>
+#include <future>
+#include <memory>
+
+class ReaderQueuePrivate;
+
+// Runs card commands of each reader in order on one worker thread per reader
+class ReaderQueue
+{
+public:
+	static ReaderQueue& instance();
+
+	void cancel(const QString &reader);
+
+	template<class F>
+	auto enqueue(const QString &reader, F job) -> std::future<decltype(job())>
+	{
+		auto task = std::make_shared<std::packaged_task<decltype(job())()>>(std::move(job));
+		std::future<decltype(job())> result = task->get_future();
+		post(reader, [task] { (*task)(); });
+		return result;
+	}
+
+	// Waits for the job while processing events, cancelled job throws std::future_error
+	template<class F>
+	auto exec(const QString &reader, F job) -> decltype(job())
+	{
+		QEventLoop l;
+		// Quit is queued when job is run or cancelled, it cannot get lost before exec() starts
+		std::shared_ptr<void> quit(nullptr, [&l](void *) {
+			QMetaObject::invokeMethod(&l, "quit", Qt::QueuedConnection);
+		});
+		auto task = std::make_shared<std::packaged_task<decltype(job())()>>([&job] { return job(); });
+		std::future<decltype(job())> result = task->get_future();
+		post(reader, [task, quit] { (*task)(); });
+		quit.reset();
+		l.exec();
+		return result.get();
+	}
+
+private:
+	ReaderQueue();
+	~ReaderQueue();
+	Q_DISABLE_COPY(ReaderQueue)
+
+	void post(const QString &reader, std::function<void()> job);
+
+	ReaderQueuePrivate *d;
+};
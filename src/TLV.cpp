@@ -0,0 +1,94 @@
+/*
+ * QEstEidUtil
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "TLV.h"
+
+#include <QtCore/QByteArray>
+
+TLV TLV::find(const QByteArray &data, quint32 tag)
+{
+	return find(data.constData(), data.constData() + data.size(), tag);
+}
+
+TLV TLV::find(const char *begin, const char *end, quint32 tag, int depth)
+{
+	// Depth first search, nested templates are limited to keep malformed input off the stack
+	for(TLV tlv = next(begin, end); tlv.isValid(); tlv = next(begin, end))
+	{
+		if(tlv.tag == tag)
+			return tlv;
+		if(tlv.constructed && depth < 8)
+		{
+			TLV child = find(tlv.value, tlv.value + tlv.length, tag, depth + 1);
+			if(child.isValid())
+				return child;
+		}
+	}
+	return TLV();
+}
+
+TLV TLV::next(const char *&pos, const char *end)
+{
+	// Skip padding between elements
+	while(pos < end && (quint8(*pos) == 0x00 || quint8(*pos) == 0xFF))
+		++pos;
+	TLV tlv;
+	if(pos >= end)
+		return tlv;
+	const char *p = pos;
+	pos = end; // Stop iteration on malformed input
+	tlv.constructed = quint8(*p) & 0x20;
+	tlv.tag = quint8(*p++);
+	if((tlv.tag & 0x1F) == 0x1F)
+	{
+		do
+		{
+			if(p == end || tlv.tag > 0xFFFFFF)
+				return TLV();
+			tlv.tag = tlv.tag << 8 | quint8(*p);
+		} while(quint8(*p++) & 0x80);
+	}
+	if(p == end)
+		return TLV();
+	quint32 length = quint8(*p++);
+	if(length & 0x80)
+	{
+		// Indefinite length is not used in card responses
+		int count = length & 0x7F;
+		if(count == 0 || count > 3 || end - p < count)
+			return TLV();
+		for(length = 0; count > 0; --count)
+			length = length << 8 | quint8(*p++);
+	}
+	if(length > quint32(end - p))
+		return TLV();
+	tlv.value = p;
+	tlv.length = int(length);
+	pos = p + length;
+	return tlv;
+}
+
+quint32 TLV::toUInt() const
+{
+	quint32 result = 0;
+	for(int i = 0; i < length && i < 4; ++i)
+		result = result << 8 | quint8(value[i]);
+	return result;
+}
@@ -0,0 +1,40 @@
+/*
+ * QEstEidUtil
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#pragma once
+
+#include <QtCore/QtGlobal>
+
+class QByteArray;
+
+// BER-TLV element, value points into the parsed buffer
+struct TLV
+{
+	quint32 tag = 0;
+	bool constructed = false;
+	const char *value = nullptr;
+	int length = 0;
+
+	bool isValid() const { return value; }
+	quint32 toUInt() const;
+	static TLV find(const QByteArray &data, quint32 tag);
+	static TLV find(const char *begin, const char *end, quint32 tag, int depth = 0);
+	static TLV next(const char *&pos, const char *end);
+};
@@ -19,7 +19,9 @@
 
 #include "Updater.h"
 #include "ui_Updater.h"
+#include "CardCommand.h"
 #include "QSmartCard.h"
+#include "ReaderQueue.h"
 
 #include "common/Common.h"
 #include "common/Configuration.h"
@@ -47,7 +49,6 @@
 #include <openssl/ecdsa.h>
 
 #include <memory>
-#include <thread>
 
 Q_LOGGING_CATEGORY(ULog,"qesteidutil.Updater")
 
@@ -97,8 +98,8 @@ public:
 		}
 
 		// Set card parameters
-		if(!d->reader->transfer(APDU("0022F301 00")).resultOk() || // SecENV 1
-			!d->reader->transfer(APDU("002241B8 02 8300")).resultOk()) //Key reference, 8303801100
+		if(!d->reader->transfer(QByteArrayLiteral("\x00\x22\xF3\x01\x00")).resultOk() || // SecENV 1
+			!d->reader->transfer(QByteArrayLiteral("\x00\x22\x41\xB8\x02\x83\x00")).resultOk()) //Key reference, 8303801100
 		{
 			d->reader->endTransaction();
 			d->reader->disconnect();
@@ -106,10 +107,8 @@ public:
 		}
 
 		// calc signature
-		QByteArray cmd = APDU("00880000 00");
-		cmd[4] = char(digst_len);
-		cmd += QByteArray::fromRawData((const char*)dgst, digst_len);
-		QPCSCReader::Result result = d->reader->transfer(cmd);
+		QPCSCReader::Result result = d->reader->transfer(
+			EstEID::CALCSIGN.withData({QByteArray::fromRawData((const char*)dgst, digst_len)}));
 		d->reader->endTransaction();
 		d->reader->disconnect();
 		if(!result)
@@ -204,18 +203,15 @@ QPCSCReader::Result UpdaterPrivate::verifyPIN(const QString &title, int p1) cons
 		pinLabel->setText(text + error + "<br />");
 		Common::setAccessibleName(pinLabel);
 
-		QByteArray verify = APDU("00200000 00");
-		verify[3] = p1;
+		const CardCommand verify = EstEID::VERIFY.withP2(quint8(p1));
 		QPCSCReader::Result result;
 		if(reader->isPinPad())
 		{
 			pinProgress->setValue(pinProgress->maximum());
-			std::thread([&]{
-				result = reader->transferCTL(verify, true);
-				l.quit();
-			}).detach();
 			statusTimer->start();
-			l.exec();
+			result = ReaderQueue::instance().exec(reader->name(), [&] {
+				return reader->transferCTL(verify.withData({}), true);
+			});
 			statusTimer->stop();
 		}
 		else
@@ -223,10 +219,7 @@ QPCSCReader::Result UpdaterPrivate::verifyPIN(const QString &title, int p1) cons
 			pinInput->clear();
 			pinInput->setFocus();
 			if(l.exec() == 1)
-			{
-				verify[4] = pinInput->text().size();
-				result = reader->transfer(verify + pinInput->text().toUtf8());
-			}
+				result = reader->transfer(verify.withData({pinInput->text().toUtf8()}));
 		}
 		switch( (quint8(result.SW[0]) << 8) + quint8(result.SW[1]) )
 		{
@@ -373,7 +366,8 @@ void Updater::process(const QByteArray &data)
 	}
 	else if(cmd == "APDU")
 	{
-		std::thread([=]{
+		// Commands are sent in order of arrival
+		ReaderQueue::instance().enqueue(d->reader->name(), [=]{
 			QPCSCReader::Result result = d->reader->transfer(APDU(obj.value("bytes").toString().toLatin1()));
 			QVariantHash ret;
 			ret["APDU"] = result.err ? "NOK" : "OK";
@@ -381,7 +375,7 @@ void Updater::process(const QByteArray &data)
 			if(result.err)
 				ret["ERROR"] = QString::number(result.err, 16);
 			Q_EMIT send(ret);
-		}).detach();
+		});
 	}
 	else if(cmd == "MESSAGE")
 	{
@@ -420,7 +414,10 @@ void Updater::process(const QByteArray &data)
 	}
 	else if(cmd == "DECRYPT")
 	{
-		QPCSCReader::Result result = d->reader->transfer(APDU(obj.value("bytes").toString().toLatin1()));
+		// Runs after APDU commands that are still queued
+		QPCSCReader::Result result = ReaderQueue::instance().exec(d->reader->name(), [&] {
+			return d->reader->transfer(APDU(obj.value("bytes").toString().toLatin1()));
+		});
 		if(result.resultOk())
 		{
 			QPixmap pinEnvelope(QSize(d->message->width(), 100));
@@ -480,31 +477,22 @@ int Updater::exec()
 	// Read certificate
 	d->reader->connect();
 	d->reader->beginTransaction();
-	if(!d->reader->transfer(APDU("00A40000 00")).resultOk())
+	const QByteArray masterFile = QByteArrayLiteral("\x00\xA4\x00\x00\x00");
+	if(!d->reader->transfer(masterFile).resultOk())
 	{
 		// Master file selection failed, test if it is updater applet
-		d->reader->transfer(APDU("00A40400 0A D2330000005550443101"));
-		d->reader->transfer(APDU("00A40000 00"));
+		d->reader->transfer(QByteArrayLiteral("\x00\xA4\x04\x00\x0A\xD2\x33\x00\x00\x00\x55\x50\x44\x31\x01"));
+		d->reader->transfer(masterFile);
 	}
-	d->reader->transfer(APDU("00A40000 00"));
-	d->reader->transfer(APDU("00A40100 02 EEEE"));
-	QPCSCReader::Result data = d->reader->transfer(APDU("00A40200 02 AACE"));
-	QHash<quint8,QByteArray> fci = QSmartCard::parseFCI(data.data);
-	int size = fci.contains(0x85) ? fci[0x85][0] << 8 | fci[0x85][1] : 0x0600;
-	QByteArray certData;
-	while(certData.size() < size)
+	d->reader->transfer(masterFile);
+	d->reader->transfer(QByteArrayLiteral("\x00\xA4\x01\x00\x02\xEE\xEE"));
+	QPCSCReader::Result data = d->reader->transfer(QByteArrayLiteral("\x00\xA4\x02\x00\x02\xAA\xCE"));
+	QByteArray certData = QSmartCard::readCert(d->reader, data.data);
+	if(certData.isEmpty())
 	{
-		QByteArray apdu = APDU("00B00000 00");
-		apdu[2] = certData.size() >> 8;
-		apdu[3] = certData.size();
-		QPCSCReader::Result result = d->reader->transfer(apdu);
-		if(!result.resultOk())
-		{
-			d->reader->endTransaction();
-			d->label->setText(tr("Failed to read certificate"));
-			return QDialog::exec();
-		}
-		certData += result.data;
+		d->reader->endTransaction();
+		d->label->setText(tr("Failed to read certificate"));
+		return QDialog::exec();
 	}
 
 	d->reader->endTransaction();
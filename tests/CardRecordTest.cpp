@@ -0,0 +1,135 @@
+/*
+ * QEstEidUtil
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "CardRecord.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDate>
+#include <QtCore/QTextCodec>
+#include <QtTest/QtTest>
+
+class CardRecordTest: public QObject
+{
+	Q_OBJECT
+private slots:
+	void cp1252();
+	void cp1252Benchmark();
+	void cp1252CodecBenchmark();
+	void date();
+	void date_data();
+	void dateBenchmark();
+	void dateFromStringBenchmark();
+
+private:
+	static QList<QByteArray> records();
+};
+
+QList<QByteArray> CardRecordTest::records()
+{
+	return {"M\xC4NNIK", "MARI-LIIS", "EST", "24.12.1980", "TALLINN", "AA0000000",
+		"A1234567", "01.01.2025", "\x8A\x9E\x8E\x9A\xD5\xF5"};
+}
+
+void CardRecordTest::cp1252()
+{
+	QTextCodec *codec = QTextCodec::codecForName("Windows-1252");
+	QVERIFY(codec);
+	for(int i = 0; i < 0x100; ++i)
+	{
+		QByteArray data(1, char(i));
+		QString expected = codec->toUnicode(data);
+		QString actual = CardRecord::fromCp1252(data);
+		QCOMPARE(actual.size(), 1);
+		// Unassigned bytes are codec specific: ICU keeps C1 controls, Qt's own table gives U+FFFD
+		if(expected == QString(QChar::ReplacementCharacter))
+			QCOMPARE(actual.at(0).unicode(), ushort(i));
+		else
+			QCOMPARE(actual, expected);
+	}
+	QCOMPARE(CardRecord::fromCp1252(QByteArray()), QString());
+	QCOMPARE(CardRecord::fromCp1252("M\xC4NNIK"), QString::fromUtf8("M\xC3\x84NNIK"));
+}
+
+void CardRecordTest::cp1252Benchmark()
+{
+	const QList<QByteArray> data = records();
+	QBENCHMARK {
+		for(const QByteArray &record: data)
+			CardRecord::fromCp1252(record);
+	}
+}
+
+void CardRecordTest::cp1252CodecBenchmark()
+{
+	const QList<QByteArray> data = records();
+	QBENCHMARK {
+		QTextCodec *codec = QTextCodec::codecForName("Windows-1252");
+		for(const QByteArray &record: data)
+			codec->toUnicode(record);
+	}
+}
+
+void CardRecordTest::date()
+{
+	QFETCH(QByteArray, data);
+	QFETCH(QDate, expected);
+	QCOMPARE(CardRecord::parseDate(data), expected);
+}
+
+void CardRecordTest::date_data()
+{
+	QTest::addColumn<QByteArray>("data");
+	QTest::addColumn<QDate>("expected");
+	QTest::newRow("valid") << QByteArray("24.12.1980") << QDate(1980, 12, 24);
+	QTest::newRow("leap day") << QByteArray("29.02.2000") << QDate(2000, 2, 29);
+	QTest::newRow("no leap day") << QByteArray("29.02.2001") << QDate();
+	QTest::newRow("bad day") << QByteArray("32.01.2000") << QDate();
+	QTest::newRow("bad month") << QByteArray("01.13.2000") << QDate();
+	QTest::newRow("zero month") << QByteArray("01.00.2000") << QDate();
+	QTest::newRow("letter") << QByteArray("24.12.198a") << QDate();
+	QTest::newRow("sign") << QByteArray("+4.12.1980") << QDate();
+	QTest::newRow("dash") << QByteArray("24-12-1980") << QDate();
+	QTest::newRow("slash") << QByteArray("24/12/1980") << QDate();
+	QTest::newRow("swapped") << QByteArray("24.1.21980") << QDate();
+	QTest::newRow("short") << QByteArray("4.12.1980") << QDate();
+	QTest::newRow("truncated") << QByteArray("24.12.") << QDate();
+	QTest::newRow("long") << QByteArray("24.12.19800") << QDate();
+	QTest::newRow("empty") << QByteArray() << QDate();
+}
+
+void CardRecordTest::dateBenchmark()
+{
+	const QByteArray data("24.12.1980");
+	QBENCHMARK {
+		CardRecord::parseDate(data);
+	}
+}
+
+void CardRecordTest::dateFromStringBenchmark()
+{
+	const QByteArray data("24.12.1980");
+	QBENCHMARK {
+		QDate::fromString(QString::fromLatin1(data), QStringLiteral("dd.MM.yyyy"));
+	}
+}
+
+QTEST_APPLESS_MAIN(CardRecordTest)
+
+#include "CardRecordTest.moc"
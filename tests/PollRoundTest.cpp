@@ -0,0 +1,153 @@
+/*
+ * QEstEidUtil
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "PollRound.h"
+
+#include <QtTest/QtTest>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<int> allocations{0};
+
+#ifdef __GLIBC__
+// Qt containers allocate with malloc and realloc, glibc lets the executable replace them
+extern "C" void *__libc_malloc(std::size_t size);
+extern "C" void *__libc_calloc(std::size_t count, std::size_t size);
+extern "C" void *__libc_realloc(void *p, std::size_t size);
+
+extern "C" void *malloc(std::size_t size)
+{
+	++allocations;
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(std::size_t count, std::size_t size)
+{
+	++allocations;
+	return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *p, std::size_t size)
+{
+	++allocations;
+	return __libc_realloc(p, size);
+}
+
+void* operator new(std::size_t size)
+{
+	if(void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+#else
+// Elsewhere only std containers are counted, Qt containers are checked by sharing
+void* operator new(std::size_t size)
+{
+	++allocations;
+	if(void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+#endif
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+class PollRoundTest: public QObject
+{
+	Q_OBJECT
+private slots:
+	void changedCards();
+	void failedPoll();
+	void unchangedRound();
+
+private:
+	static bool poll(PollRound &round, const QStringList &readers, const QStringList &cards);
+};
+
+bool PollRoundTest::poll(PollRound &round, const QStringList &readers, const QStringList &cards)
+{
+	round.reset(readers.size());
+	for(int i = 0; i < readers.size(); ++i)
+	{
+		if(cards.at(i).isNull())
+			continue;
+		round.readers[size_t(i)].polled = true;
+		round.readers[size_t(i)].card = cards.at(i);
+	}
+	if(!round.collect(readers))
+		return false;
+	round.sortCards([](const QString &a, const QString &b) { return a < b; });
+	return true;
+}
+
+void PollRoundTest::changedCards()
+{
+	const QStringList readers{"Reader 0", "Reader 1"};
+	PollRound round;
+	QVERIFY(poll(round, readers, {"B2000001", "A1000002"}));
+	const QStringList order = round.order;
+	QCOMPARE(order, QStringList({"A1000002", "B2000001"}));
+
+	QVERIFY(poll(round, readers, {"B2000001", QLatin1String("")}));
+	QVERIFY(!order.isSharedWith(round.order));
+	QCOMPARE(round.order, QStringList({"B2000001"}));
+	QVERIFY(!round.contains("A1000002"));
+	QCOMPARE(round.reader("B2000001"), QString("Reader 0"));
+	QCOMPARE(round.reader("A1000002"), QString());
+}
+
+void PollRoundTest::failedPoll()
+{
+	PollRound round;
+	QVERIFY(!poll(round, {"Reader 0", "Reader 1"}, {"A1000002", QString()}));
+}
+
+// Idle wake-ups return to waiting before PollRound is used, this covers rounds run after
+// a reader event that did not change the cards
+void PollRoundTest::unchangedRound()
+{
+	const QStringList readers{"Reader 0", "Reader 1", "Reader 2", "Reader 3"};
+	const QStringList cards{"B2000001", QLatin1String(""), "A1000002", "C3000003"};
+	PollRound round;
+	QVERIFY(poll(round, readers, cards));
+	const QStringList order = round.order;
+
+	allocations = 0;
+	for(int i = 0; i < 100; ++i)
+		poll(round, readers, cards);
+	QCOMPARE(int(allocations), 0);
+	QVERIFY(order.isSharedWith(round.order));
+	QCOMPARE(round.order, QStringList({"A1000002", "B2000001", "C3000003"}));
+	QCOMPARE(round.reader("A1000002"), QString("Reader 2"));
+}
+
+QTEST_APPLESS_MAIN(PollRoundTest)
+
+#include "PollRoundTest.moc"
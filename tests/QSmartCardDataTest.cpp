@@ -0,0 +1,161 @@
+/*
+ * QEstEidUtil
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "QSmartCard_p.h"
+
+#include <QtCore/QHash>
+#include <QtTest/QtTest>
+
+// Layout before the arrays, kept to compare copy and lookup costs
+class LegacyDataPrivate: public QSharedData
+{
+public:
+	QString card, reader, appletVersion;
+	QStringList cards, readers;
+	QHash<QSmartCardData::PersonalDataType,QVariant> data;
+	SslCertificate authCert, signCert;
+	QHash<QSmartCardData::PinType,quint8> retry;
+	QHash<QSmartCardData::PinType,ulong> usage;
+	QSmartCardData::CardVersion version = QSmartCardData::VER_INVALID;
+	QSmartCardData::DataGroups loaded;
+	bool pinpad = false;
+};
+
+class QSmartCardDataTest: public QObject
+{
+	Q_OBJECT
+private slots:
+	void values();
+	void detachBenchmark();
+	void detachLegacyBenchmark();
+	void lookupBenchmark();
+	void lookupLegacyBenchmark();
+
+private:
+	static QVariant sample(QSmartCardData::PersonalDataType type);
+	static QSharedDataPointer<QSmartCardDataPrivate> card();
+	static QSharedDataPointer<LegacyDataPrivate> legacyCard();
+};
+
+QVariant QSmartCardDataTest::sample(QSmartCardData::PersonalDataType type)
+{
+	if(QSmartCardDataPrivate::isDate(type))
+		return QDateTime(QDate(1980, 1, 1).addYears(type));
+	return QStringLiteral("VALUE %1").arg(type);
+}
+
+QSharedDataPointer<QSmartCardDataPrivate> QSmartCardDataTest::card()
+{
+	QSharedDataPointer<QSmartCardDataPrivate> d(new QSmartCardDataPrivate);
+	d->card = d->reader = QStringLiteral("38001085718");
+	for(int type = QSmartCardData::SurName; type <= QSmartCardData::Email; ++type)
+		d->setValue(QSmartCardData::PersonalDataType(type), sample(QSmartCardData::PersonalDataType(type)));
+	for(int type = QSmartCardData::Pin1Type; type <= QSmartCardData::PukType; ++type)
+	{
+		d->retry[type] = 3;
+		d->usage[type] = 100 * type;
+	}
+	return d;
+}
+
+QSharedDataPointer<LegacyDataPrivate> QSmartCardDataTest::legacyCard()
+{
+	QSharedDataPointer<LegacyDataPrivate> d(new LegacyDataPrivate);
+	d->card = d->reader = QStringLiteral("38001085718");
+	for(int type = QSmartCardData::SurName; type <= QSmartCardData::Email; ++type)
+		d->data[QSmartCardData::PersonalDataType(type)] = sample(QSmartCardData::PersonalDataType(type));
+	for(int type = QSmartCardData::Pin1Type; type <= QSmartCardData::PukType; ++type)
+	{
+		d->retry[QSmartCardData::PinType(type)] = 3;
+		d->usage[QSmartCardData::PinType(type)] = 100 * type;
+	}
+	return d;
+}
+
+void QSmartCardDataTest::values()
+{
+	const QSharedDataPointer<QSmartCardDataPrivate> d = card();
+	const QSharedDataPointer<LegacyDataPrivate> legacy = legacyCard();
+	for(int type = QSmartCardData::SurName; type <= QSmartCardData::Email; ++type)
+		QCOMPARE(d->value(QSmartCardData::PersonalDataType(type)), legacy->data.value(QSmartCardData::PersonalDataType(type)));
+	QVERIFY(d->hasData());
+
+	// Writes detach, the original keeps its values
+	QSharedDataPointer<QSmartCardDataPrivate> copy = d;
+	copy->clearData();
+	copy->retry[QSmartCardData::Pin1Type] = 0;
+	QVERIFY(!copy->hasData());
+	QVERIFY(d->hasData());
+	QCOMPARE(int(d->retry[QSmartCardData::Pin1Type]), 3);
+
+	copy->copyData(*d);
+	copy->copyCounters(*d, true, false);
+	for(int type = QSmartCardData::SurName; type <= QSmartCardData::Email; ++type)
+		QCOMPARE(copy->value(QSmartCardData::PersonalDataType(type)), d->value(QSmartCardData::PersonalDataType(type)));
+	QCOMPARE(int(copy->retry[QSmartCardData::Pin1Type]), 3);
+}
+
+void QSmartCardDataTest::detachBenchmark()
+{
+	const QSharedDataPointer<QSmartCardDataPrivate> d = card();
+	QBENCHMARK {
+		QSharedDataPointer<QSmartCardDataPrivate> copy = d;
+		copy->retry[QSmartCardData::Pin1Type] = 2;
+	}
+}
+
+void QSmartCardDataTest::detachLegacyBenchmark()
+{
+	const QSharedDataPointer<LegacyDataPrivate> d = legacyCard();
+	QBENCHMARK {
+		QSharedDataPointer<LegacyDataPrivate> copy = d;
+		copy->retry[QSmartCardData::Pin1Type] = 2;
+	}
+}
+
+void QSmartCardDataTest::lookupBenchmark()
+{
+	const QSharedDataPointer<QSmartCardDataPrivate> d = card();
+	ulong found = 0;
+	QBENCHMARK {
+		for(int type = QSmartCardData::SurName; type <= QSmartCardData::Email; ++type)
+			found += d->value(QSmartCardData::PersonalDataType(type)).isValid();
+		for(int type = QSmartCardData::Pin1Type; type <= QSmartCardData::PukType; ++type)
+			found += d->retry[type] + d->usage[type];
+	}
+	QVERIFY(found);
+}
+
+void QSmartCardDataTest::lookupLegacyBenchmark()
+{
+	const QSharedDataPointer<LegacyDataPrivate> d = legacyCard();
+	ulong found = 0;
+	QBENCHMARK {
+		for(int type = QSmartCardData::SurName; type <= QSmartCardData::Email; ++type)
+			found += d->data.value(QSmartCardData::PersonalDataType(type)).isValid();
+		for(int type = QSmartCardData::Pin1Type; type <= QSmartCardData::PukType; ++type)
+			found += d->retry.value(QSmartCardData::PinType(type)) + d->usage.value(QSmartCardData::PinType(type));
+	}
+	QVERIFY(found);
+}
+
+QTEST_APPLESS_MAIN(QSmartCardDataTest)
+
+#include "QSmartCardDataTest.moc"
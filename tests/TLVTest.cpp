@@ -0,0 +1,202 @@
+/*
+ * QEstEidUtil
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include "TLV.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtTest/QtTest>
+
+class TLVTest: public QObject
+{
+	Q_OBJECT
+private slots:
+	void deepNesting();
+	void fuzzedFci();
+	void fciBenchmark();
+	void fciLegacyBenchmark();
+	void longLength();
+	void multiByteTag();
+	void padding();
+	void truncated();
+
+private:
+	static QByteArray fci();
+	static bool inBounds(const QByteArray &data, const TLV &tlv);
+	static QHash<quint8,QByteArray> parseFCI(const QByteArray &data);
+};
+
+// EstEID 3.x authentication certificate EF AACE
+QByteArray TLVTest::fci()
+{
+	return QByteArray::fromHex("62188201018302AACE850206008A0105A1088B06003001000001");
+}
+
+bool TLVTest::inBounds(const QByteArray &data, const TLV &tlv)
+{
+	if(!tlv.isValid())
+		return true;
+	return tlv.length >= 0 && tlv.value >= data.constData() &&
+		tlv.value + tlv.length <= data.constData() + data.size();
+}
+
+// Former QSmartCard::parseFCI, only safe on well formed input
+QHash<quint8,QByteArray> TLVTest::parseFCI(const QByteArray &data)
+{
+	QHash<quint8,QByteArray> result;
+	for(QByteArray::const_iterator i = data.constBegin(); i != data.constEnd(); ++i)
+	{
+		quint8 tag(*i), size(*++i);
+		result[tag] = QByteArray(i + 1, size);
+		switch(tag)
+		{
+		case 0x6F:
+		case 0x62:
+		case 0x64:
+		case 0xA1: continue;
+		default: i += size; break;
+		}
+	}
+	return result;
+}
+
+void TLVTest::deepNesting()
+{
+	auto nest = [](int depth) {
+		QByteArray data = QByteArray::fromHex("850107");
+		for(int i = 0; i < depth; ++i)
+			data = QByteArray::fromHex("62") + char(data.size()) + data;
+		return data;
+	};
+	// Elements point into the parsed buffer, it must outlive them
+	const QByteArray data = nest(8);
+	TLV tlv = TLV::find(data, 0x85);
+	QVERIFY(tlv.isValid());
+	QCOMPARE(tlv.toUInt(), 0x07u);
+	// Deeper templates are not searched
+	QVERIFY(!TLV::find(nest(9), 0x85).isValid());
+	QVERIFY(TLV::find(nest(9), 0x62).constructed);
+}
+
+void TLVTest::fuzzedFci()
+{
+	static const quint32 tags[] = {0x62, 0x82, 0x83, 0x85, 0x8A, 0xA1, 0x8B};
+	const QByteArray original = fci();
+	QCOMPARE(TLV::find(original, 0x85).toUInt(), 0x0600u);
+	QCOMPARE(TLV::find(original, 0x8B).length, 6);
+	for(int size = 0; size <= original.size(); ++size)
+	{
+		const QByteArray data = original.left(size);
+		for(quint32 tag: tags)
+			QVERIFY(inBounds(data, TLV::find(data, tag)));
+	}
+	for(int pos = 0; pos < original.size(); ++pos)
+	{
+		for(int value = 0; value < 0x100; ++value)
+		{
+			QByteArray data = original;
+			data[pos] = char(value);
+			for(quint32 tag: tags)
+				QVERIFY(inBounds(data, TLV::find(data, tag)));
+		}
+	}
+}
+
+void TLVTest::fciBenchmark()
+{
+	const QByteArray data = fci();
+	QBENCHMARK {
+		TLV fileSize = TLV::find(data, 0x85);
+		QVERIFY(fileSize.length == 2 && fileSize.toUInt() == 0x0600);
+	}
+}
+
+void TLVTest::fciLegacyBenchmark()
+{
+	const QByteArray data = fci();
+	QBENCHMARK {
+		QHash<quint8,QByteArray> info = parseFCI(data);
+		QVERIFY(info.value(0x85).size() == 2 && (quint8(info[0x85][0]) << 8 | quint8(info[0x85][1])) == 0x0600);
+	}
+}
+
+void TLVTest::longLength()
+{
+	const QByteArray value(300, 'x');
+	QByteArray data = QByteArray::fromHex("8582012C") + value;
+	TLV tlv = TLV::find(data, 0x85);
+	QVERIFY(tlv.isValid());
+	QCOMPARE(tlv.length, 300);
+	QCOMPARE(QByteArray(tlv.value, tlv.length), value);
+
+	data = QByteArray::fromHex("8681") + char(0x81) + QByteArray(0x81, 'y');
+	tlv = TLV::find(data, 0x86);
+	QVERIFY(tlv.isValid());
+	QCOMPARE(tlv.length, 0x81);
+
+	// Indefinite and over three byte lengths are rejected
+	QVERIFY(!TLV::find(QByteArray::fromHex("85800000"), 0x85).isValid());
+	QVERIFY(!TLV::find(QByteArray::fromHex("85840000000100"), 0x85).isValid());
+}
+
+void TLVTest::multiByteTag()
+{
+	QByteArray data = QByteArray::fromHex("9F0102ABCD");
+	TLV tlv = TLV::find(data, 0x9F01);
+	QVERIFY(tlv.isValid());
+	QVERIFY(!tlv.constructed);
+	QCOMPARE(tlv.length, 2);
+	QCOMPARE(tlv.toUInt(), 0xABCDu);
+
+	data = QByteArray::fromHex("7F810103850107");
+	tlv = TLV::find(data, 0x85);
+	QVERIFY(tlv.isValid());
+	QCOMPARE(tlv.toUInt(), 0x07u);
+	QVERIFY(TLV::find(data, 0x7F8101).constructed);
+
+	// Tags longer than four bytes are rejected
+	QVERIFY(!TLV::find(QByteArray::fromHex("9F808080800100"), 0x85).isValid());
+}
+
+void TLVTest::padding()
+{
+	const QByteArray data = QByteArray::fromHex("00FF850107FF00860108");
+	QCOMPARE(TLV::find(data, 0x85).toUInt(), 0x07u);
+	QCOMPARE(TLV::find(data, 0x86).toUInt(), 0x08u);
+	QCOMPARE(TLV::find(QByteArray::fromHex("620400850107"), 0x85).toUInt(), 0x07u);
+	QVERIFY(!TLV::find(QByteArray::fromHex("0000FFFF"), 0x85).isValid());
+	QVERIFY(!TLV::find(QByteArray(), 0x85).isValid());
+}
+
+void TLVTest::truncated()
+{
+	QVERIFY(!TLV::find(QByteArray::fromHex("85"), 0x85).isValid());
+	QVERIFY(!TLV::find(QByteArray::fromHex("8505010203"), 0x85).isValid());
+	QVERIFY(!TLV::find(QByteArray::fromHex("858201"), 0x85).isValid());
+	QVERIFY(!TLV::find(QByteArray::fromHex("9F"), 0x9F01).isValid());
+	QVERIFY(!TLV::find(QByteArray::fromHex("9F81"), 0x9F01).isValid());
+	// Child overruns its template
+	QVERIFY(!TLV::find(QByteArray::fromHex("6203850501860108"), 0x85).isValid());
+	QCOMPARE(TLV::find(QByteArray::fromHex("6203850501860108"), 0x86).toUInt(), 0x08u);
+}
+
+QTEST_APPLESS_MAIN(TLVTest)
+
+#include "TLVTest.moc"